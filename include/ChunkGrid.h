@@ -0,0 +1,262 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <array>
+#include <unordered_map>
+#include <vector>
+
+#include "GeometryBuilder.h"
+#include "LatencyStats.h"
+#include "PackedVertex.h"
+#include "PaletteStorage.h"
+#include "ThreadPool.h"
+#include "VoxelOctree.h"
+
+constexpr int kChunkShift = 5;
+constexpr int kChunkSize = 1 << kChunkShift;
+constexpr int kChunkMask = kChunkSize - 1;
+constexpr int kChunkVolume = kChunkSize * kChunkSize * kChunkSize;
+
+// A chunk plus a one voxel border copied from its neighbors, so meshers can
+// look at neighbors without going through the grid.
+constexpr int kPaddedSize = kChunkSize + 2;
+constexpr int kPaddedVolume = kPaddedSize * kPaddedSize * kPaddedSize;
+
+class ColumnOccupancy;
+
+// Level 0 is full resolution, level n merges 2^n voxels per axis.
+constexpr int kLodCount = 4;
+
+enum class MeshMode {
+  kNaive,   // every face of every voxel
+  kCulled,  // only faces that border air
+  kGreedy,  // visible faces merged into quads of the same palette color
+  // One up face on top of each column plus side skirts down to lower
+  // neighbor columns, for terrain without caves or overhangs.
+  kHeightfield,
+};
+
+struct ChunkCoord {
+  int x;
+  int y;
+  int z;
+
+  bool operator==(const ChunkCoord& other) const = default;
+};
+
+struct ChunkCoordHash {
+  size_t operator()(const ChunkCoord& coord) const;
+};
+
+// A vertical stack of chunks, the unit the world is streamed and cached in.
+struct ColumnCoord {
+  int x;
+  int z;
+
+  bool operator==(const ColumnCoord& other) const = default;
+};
+
+struct ColumnCoordHash {
+  size_t operator()(const ColumnCoord& coord) const;
+};
+
+// Chunks remeshed by one RebuildDirty() call, their meshes have to be
+// uploaded again and every other chunk is untouched.
+struct RemeshPatch {
+  std::vector<ChunkCoord> chunks;
+  // Wall time of the whole rebuild.
+  float milliseconds = 0;
+};
+
+class Chunk {
+ public:
+  // Voxels are stored column by column (y is the fastest axis) so that the
+  // terrain generator writes them contiguously. Palette compressed: an all air
+  // or all solid chunk takes a few bytes, a typical surface chunk 4 KiB.
+  PaletteStorage voxels_{kChunkVolume};
+  // Same voxels with uniform regions collapsed, for skipping empty space.
+  // Set() keeps it in sync, code writing voxels_ in bulk rebuilds it once
+  // done (TerrainGenerator::FillChunk(), RegionCache::LoadColumn()).
+  VoxelOctree octree_{kChunkSize};
+  GeometryBuilder mesh_;
+  // Downsampled meshes for LOD 1 and up, empty unless the grid builds LODs.
+  std::array<GeometryBuilder, kLodCount - 1> lod_meshes_;
+  bool dirty_ = true;
+  // Set by ChunkGrid::SetVoxel() when the chunk or its padded border
+  // changes, the voxels and meshes no longer match the generated ones.
+  bool edited_ = false;
+  // Bumped whenever the chunk or its padded border changes, so meshes built
+  // from an older snapshot can be told apart.
+  uint32_t revision_ = 0;
+
+  const GeometryBuilder& Mesh(int lod) const {
+    return lod == 0 ? mesh_ : lod_meshes_[lod - 1];
+  }
+
+  // Bytes held by the voxels, the octree and the meshes.
+  size_t memory_usage() const;
+
+  static int Index(int x, int y, int z) {
+    return (x * kChunkSize + z) * kChunkSize + y;
+  }
+
+  VoxelId Get(int x, int y, int z) const { return voxels_.Get(Index(x, y, z)); }
+  void Set(int x, int y, int z, VoxelId id) {
+    voxels_.Set(Index(x, y, z), id);
+    octree_.Set(x, y, z, id);
+  }
+};
+
+struct RaycastHit {
+  // World voxel coordinates of the solid voxel hit.
+  int voxel[3];
+  // Face of that voxel the ray entered through, kFaceCount when the ray
+  // started inside it.
+  CubeFace face;
+  // Along the ray, in world units.
+  float distance;
+};
+
+/**
+ * @brief Voxel world split in fixed-size chunks, each chunk owns its mesh.
+ * Editing a voxel only marks the owning chunk dirty, RebuildDirty() then
+ * remeshes the dirty chunks and nothing else.
+ */
+class ChunkGrid {
+ public:
+  using ChunkMap = std::unordered_map<ChunkCoord, Chunk, ChunkCoordHash>;
+
+  // Bump whenever the meshes built for given voxels and settings change,
+  // meshes cached by an older version are then built again.
+  static constexpr uint32_t kMeshVersion = 1;
+
+  // Color of the top face of each material, indexed by VoxelId.
+  std::vector<Vec3> palette_;
+  MeshMode mesh_mode_ = MeshMode::kCulled;
+  // Merge identical vertices of each chunk mesh after meshing.
+  bool weld_vertices_ = false;
+  // Reorder the triangles of each chunk mesh for the post-transform cache.
+  bool optimize_vertex_cache_ = false;
+  // Darken face corners by the voxels around them, culled and greedy meshes
+  // only.
+  bool ambient_occlusion_ = false;
+
+  // Also build the downsampled meshes of every LOD level.
+  bool build_lods_ = false;
+  // Camera distance, in world units, from which LOD 1, 2, ... is used.
+  std::array<float, kLodCount - 1> lod_distances_ = {20, 40, 70};
+
+  explicit ChunkGrid(float voxel_scale = 1);
+
+  VoxelId GetVoxel(int x, int y, int z) const;
+  // Dirties the owning chunk, plus the neighbors whose border holds the
+  // voxel when it sits on a chunk boundary.
+  void SetVoxel(int x, int y, int z, VoxelId id);
+  void ClearVoxel(int x, int y, int z) { SetVoxel(x, y, z, kAir); }
+
+  Chunk* FindChunk(ChunkCoord coord);
+  const Chunk* FindChunk(ChunkCoord coord) const;
+  Chunk& GetOrCreateChunk(ChunkCoord coord);
+  void RemoveChunk(ChunkCoord coord) { chunks_.erase(coord); }
+
+  /**
+   * @brief Walks a ray through the voxels up to the first solid one. Missing
+   * chunks and empty octree nodes are crossed in one step.
+   * @param direction Normalized, in world space like `origin`.
+   */
+  bool Raycast(const Math::Vec3F& origin, const Math::Vec3F& direction,
+               float max_distance, RaycastHit* hit) const;
+
+  // Whether every voxel of the box [min, max), in world voxel coordinates,
+  // is air.
+  bool IsRegionEmpty(const int min[3], const int max[3]) const;
+
+  /**
+   * @brief Rebuilds the mesh of every dirty chunk, the time spent on each
+   * chunk goes into remesh_latency().
+   * @param pool When set, the chunks are meshed in parallel on its workers.
+   * @return The chunks that were rebuilt.
+   */
+  RemeshPatch RebuildDirty(ThreadPool* pool = nullptr);
+
+  // Per chunk remesh time in milliseconds, LOD meshes included.
+  const LatencyStats& remesh_latency() const { return remesh_latency_; }
+
+  void MarkAllDirty();
+
+  /**
+   * @brief Copies the chunk and the border voxels of its 26 neighbors.
+   * @param out Receives kPaddedVolume voxels, see PaddedIndex().
+   */
+  void GatherPadded(ChunkCoord coord, std::vector<VoxelId>& out) const;
+
+  // Index in a padded buffer, local coordinates go from -1 to kChunkSize.
+  static int PaddedIndex(int x, int y, int z) {
+    return ((x + 1) * kPaddedSize + (z + 1)) * kPaddedSize + (y + 1);
+  }
+
+  /**
+   * @brief Rebuilds the meshes of `chunk` from `padded`, as filled by
+   * GatherPadded(), and from its octree which must match its voxels. Never
+   * looks at the other chunks, so it can run on a worker while the grid
+   * keeps changing.
+   */
+  void MeshChunk(ChunkCoord coord, const std::vector<VoxelId>& padded,
+                 Chunk& chunk) const;
+
+  /**
+   * @brief kHeightfield mesh of a chunk built from column heights alone, for
+   * terrain solid from `min_y` up to a height. The voxels are never read,
+   * the result is the mesh MeshChunk() builds from the matching voxels.
+   * @param tops One past the highest solid voxel of each column of the chunk
+   * and of its border, at (x + 1) * kPaddedSize + (z + 1). Columns with a top
+   * at or below `min_y` are empty.
+   * @param materials Voxel of each column of the chunk, at x * kChunkSize + z.
+   */
+  void MeshHeightfield(ChunkCoord coord, const int* tops,
+                       const VoxelId* materials, int min_y,
+                       Chunk& chunk) const;
+
+  /**
+   * @brief Culled mesh of a chunk in the 8 byte PackedVertex format, with
+   * positions relative to the chunk origin.
+   */
+  void MeshPacked(ChunkCoord coord, PackedGeometryBuilder& out) const;
+
+  /**
+   * @brief LOD level to draw a chunk with, from the distance between the
+   * camera and the chunk center.
+   */
+  int SelectLod(ChunkCoord coord, const Math::Vec3F& camera_position) const;
+
+  const ChunkMap& chunks() const { return chunks_; }
+  float voxel_scale() const { return voxel_scale_; }
+
+  static ChunkCoord ToChunkCoord(int x, int y, int z) {
+    return {x >> kChunkShift, y >> kChunkShift, z >> kChunkShift};
+  }
+
+ private:
+  // Face mask of every voxel of a chunk, returns the face count. Whole
+  // columns are culled at once and only voxels with a visible face are
+  // written.
+  static size_t FindVisibleFaces(const ColumnOccupancy& occupancy,
+                                 std::vector<uint8_t>& visible);
+
+  void MeshChunk(ChunkCoord coord, Chunk& chunk) const;
+  void MeshNaive(ChunkCoord coord, Chunk& chunk) const;
+  void MeshCulled(ChunkCoord coord, const std::vector<VoxelId>& padded,
+                  const ColumnOccupancy& occupancy, Chunk& chunk) const;
+  void MeshGreedy(ChunkCoord coord, const std::vector<VoxelId>& padded,
+                  const ColumnOccupancy& occupancy, Chunk& chunk) const;
+  void MeshHeightfield(ChunkCoord coord, const std::vector<VoxelId>& padded,
+                       const ColumnOccupancy& occupancy, Chunk& chunk) const;
+  void MeshLod(ChunkCoord coord, const std::vector<VoxelId>& padded, int lod,
+               GeometryBuilder& out) const;
+  void FinishMesh(GeometryBuilder& mesh) const;
+
+  float voxel_scale_;
+  ChunkMap chunks_;
+  LatencyStats remesh_latency_;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <array>
+#include <vector>
+
+#include "ChunkGrid.h"
+
+/**
+ * @brief Solid voxels of a padded chunk buffer as one 64-bit mask per
+ * column, so neighbor tests along a column are shifts and ANDs over every
+ * voxel at once.
+ *
+ * Bit y + 1 of a column holds local height y, from -1 to kChunkSize.
+ */
+class ColumnOccupancy {
+ public:
+  // Bits of the heights inside the chunk, 0 to kChunkSize - 1.
+  static constexpr uint64_t kInside = ((uint64_t{1} << kChunkSize) - 1) << 1;
+
+  // `padded` as filled by ChunkGrid::GatherPadded().
+  explicit ColumnOccupancy(const std::vector<VoxelId>& padded);
+
+  // Local coordinates go from -1 to kChunkSize.
+  uint64_t Column(int x, int z) const {
+    return columns_[(x + 1) * kPaddedSize + (z + 1)];
+  }
+  bool IsSolid(int x, int y, int z) const {
+    return (Column(x, z) >> (y + 1)) & 1;
+  }
+
+  // Voxels of the chunk column (x, z) whose `face` borders air.
+  uint64_t VisibleFaces(int x, int z, int face) const {
+    uint64_t column = Column(x, z);
+    uint64_t solid = column & kInside;
+    switch (face) {
+      case kFaceUp:
+        return solid & ~(column >> 1);
+      case kFaceDown:
+        return solid & ~(column << 1);
+      default:
+        return solid & ~Column(x + kFaceNormals[face][0],
+                               z + kFaceNormals[face][2]);
+    }
+  }
+
+  // Local height of the highest solid voxel of the chunk column (x, z), -1
+  // when the column is all air.
+  int TopSolid(int x, int z) const;
+
+  /**
+   * @brief Solid voxels of the 3x3 layer in front of a face of the voxel
+   * (x, y, z): bit (dv + 1) * 3 + du + 1 for the voxel du, dv away along the
+   * axes u = (d + 1) % 3 and v = (d + 2) % 3, d the axis of the face normal.
+   */
+  int FrontLayer(int x, int y, int z, int face) const;
+
+ private:
+  std::array<uint64_t, kPaddedSize * kPaddedSize> columns_;
+};
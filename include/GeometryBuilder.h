@@ -4,14 +4,18 @@
 #include <stdint.h>
 
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <cstdlib>
 #include <ctime>
 #include <numeric>
 #include <random>
+#include <span>
+#include <utility>
 #include <vector>
 
 #include "../../../../Downloads/DirectX11_Learning-master/DirectX11_Learning-master/DirectX11_Learning/Math.h"
+#include "math/NVec3.h"
 struct Vertex {
   Vec3 position;
   Vec2 uv;
@@ -25,26 +29,268 @@ static void Shuffle(std::vector<int>::iterator begin,
   std::shuffle(begin, end, g);
 }
 
+// Conservative range of a noise over a region: no point of the region
+// evaluates below min or above max.
+struct NoiseBounds {
+  float min;
+  float max;
+};
+
 class Perlin {
  public:
   std::vector<int> hash_;
 
   Perlin();
   Perlin(std::vector<int> hash);
+  // Same permutation for the same seed on every platform.
+  explicit Perlin(uint64_t seed);
+
+  // Defined below so Fbm kernels inline them.
+  int noise(int x, int y) const;
+  float lin_inter(float x, float y, float s) const;
+  float smooth_inter(float x, float y, float s) const;
+  float noise2d(float x, float y) const;
+  float perlin2d(float x, float y, float freq, int depth) const;
+
+  /**
+   * @brief Bounds of noise2d() over the lattice space rectangle [x_min,
+   * x_max] x [y_min, y_max]: the smallest and largest corner of the cells it
+   * covers, since each interpolation stays between its corners.
+   */
+  NoiseBounds noise2d_bounds(float x_min, float y_min, float x_max,
+                             float y_max) const;
+
+  /**
+   * @brief perlin2d() of every point (x0 + i, y0 + k) of a size_x x size_y
+   * grid into out[i * size_y + k], with the same results. Samples sharing a
+   * lattice cell share its hashes and x interpolation, and the y fade of
+   * each grid column is computed once for all rows.
+   */
+  void perlin2d_grid(float x0, float y0, int size_x, int size_y, float freq,
+                     int depth, float* out) const;
+
+  /**
+   * @brief Improved Perlin gradient noise (Perlin 2002) on the same hash
+   * table, in [-1, 1] and 0 on every lattice point.
+   */
+  float noise3d(float x, float y, float z) const;
+};
+
+inline int Perlin::noise(int x, int y) const {
+  // Same as % 256 for positive coordinates, and stays in range below zero.
+  int tmp = hash_[y & 255];
+  return hash_[(tmp + x) & 255];
+}
+inline float Perlin::lin_inter(float x, float y, float s) const {
+  return x + s * (y - x);
+}
+inline float Perlin::smooth_inter(float x, float y, float s) const {
+  return lin_inter(x, y, s * s * (3 - 2 * s));
+}
+inline float Perlin::noise2d(float x, float y) const {
+  int x_int = static_cast<int>(std::floor(x));
+  int y_int = static_cast<int>(std::floor(y));
+  float x_frac = x - x_int;
+  float y_frac = y - y_int;
+  int s = noise(x_int, y_int);
+  int t = noise(x_int + 1, y_int);
+  int u = noise(x_int, y_int + 1);
+  int v = noise(x_int + 1, y_int + 1);
+  float low = smooth_inter(s, t, x_frac);
+  float high = smooth_inter(u, v, x_frac);
+  return smooth_inter(low, high, y_frac);
+}
+
+/**
+ * @brief Fractal sum of Octaves noise2d() octaves, each one at twice the
+ * frequency and Persistence times the amplitude of the previous one. The
+ * octave loop is unrolled and the normalization is a constant, so
+ * Fbm<N>(perlin)(x, y, freq) gives perlin.perlin2d(x, y, freq, N) without
+ * any branch.
+ */
+template <int Octaves, float Persistence = 0.5f>
+class Fbm {
+ public:
+  static_assert(Octaves >= 1);
+
+  static constexpr std::array<float, Octaves> kAmplitudes = [] {
+    std::array<float, Octaves> amplitudes;
+    float amp = 1;
+    for (int i = 0; i < Octaves; i++) {
+      amplitudes[i] = amp;
+      amp *= Persistence;
+    }
+    return amplitudes;
+  }();
+  // 256, the noise2d() range, times the sum of the amplitudes.
+  static constexpr float kNormalization = [] {
+    float div = 0;
+    for (float amp : kAmplitudes) {
+      div += 256 * amp;
+    }
+    return div;
+  }();
+
+  explicit Fbm(const Perlin& perlin) : perlin_(perlin) {}
+
+  float operator()(float x, float y, float freq) const {
+    return Sum(x * freq, y * freq,
+               std::make_integer_sequence<int, Octaves>()) /
+           kNormalization;
+  }
+
+  // Bounds over the rectangle [x_min, x_max] x [y_min, y_max], the sum of the
+  // bounds of each octave. The corners go through the same float operations
+  // as the samples of operator() and Grid(), rounding being monotonic every
+  // sample then falls in the lattice cells covered.
+  NoiseBounds Bounds(float x_min, float y_min, float x_max, float y_max,
+                     float freq) const {
+    NoiseBounds bounds = {0, 0};
+    for (int octave = 0; octave < Octaves; octave++) {
+      float scale = 1 << octave;
+      NoiseBounds octave_bounds = perlin_.noise2d_bounds(
+          x_min * freq * scale, y_min * freq * scale, x_max * freq * scale,
+          y_max * freq * scale);
+      bounds.min += octave_bounds.min * kAmplitudes[octave];
+      bounds.max += octave_bounds.max * kAmplitudes[octave];
+    }
+    return {bounds.min / kNormalization, bounds.max / kNormalization};
+  }
+
+  // The same on a grid, see Perlin::perlin2d_grid().
+  void Grid(float x0, float y0, int size_x, int size_y, float freq,
+            float* out) const {
+    if constexpr (Persistence == 0.5f) {
+      perlin_.perlin2d_grid(x0, y0, size_x, size_y, freq, Octaves, out);
+    } else {
+      for (int i = 0; i < size_x; i++) {
+        for (int k = 0; k < size_y; k++) {
+          out[i * size_y + k] = (*this)(x0 + i, y0 + k, freq);
+        }
+      }
+    }
+  }
+
+ private:
+  template <int... Octave>
+  float Sum(float xa, float ya, std::integer_sequence<int, Octave...>) const {
+    float fin = 0;
+    ((fin += perlin_.noise2d(xa * (1 << Octave), ya * (1 << Octave)) *
+             kAmplitudes[Octave]),
+     ...);
+    return fin;
+  }
+
+  const Perlin& perlin_;
+};
+
+// Cube faces in the order PushCube emits them.
+enum CubeFace : uint8_t {
+  kFaceFront,  // +z
+  kFaceUp,     // +y
+  kFaceBack,   // -z
+  kFaceDown,   // -y
+  kFaceRight,  // +x
+  kFaceLeft,   // -x
+  kFaceCount
+};
 
-  int noise(int x, int y);
-  float lin_inter(float x, float y, float s);
-  float smooth_inter(float x, float y, float s);
-  float noise2d(float x, float y);
-  float perlin2d(float x, float y, float freq, int depth);
+constexpr uint8_t kAllFaces = (1 << kFaceCount) - 1;
+
+// Unit offset towards the neighbor that a face looks at.
+constexpr int kFaceNormals[kFaceCount][3] = {
+    {0, 0, 1}, {0, 1, 0}, {0, 0, -1}, {0, -1, 0}, {1, 0, 0}, {-1, 0, 0},
+};
+
+// Corners of a unit cube centered on the origin, four per face in CubeFace
+// order.
+constexpr float kCubeCorners[kFaceCount * 4][3] = {
+    {0.5f, 0.5f, 0.5f},    {0.5f, -0.5f, 0.5f},    // front
+    {-0.5f, -0.5f, 0.5f},  {-0.5f, 0.5f, 0.5f},
+
+    {0.5f, 0.5f, -0.5f},   {0.5f, 0.5f, 0.5f},     // up
+    {-0.5f, 0.5f, 0.5f},   {-0.5f, 0.5f, -0.5f},
+
+    {0.5f, 0.5f, -0.5f},   {0.5f, -0.5f, -0.5f},   // back
+    {-0.5f, -0.5f, -0.5f}, {-0.5f, 0.5f, -0.5f},
+
+    {0.5f, -0.5f, -0.5f},  {0.5f, -0.5f, 0.5f},    // down
+    {-0.5f, -0.5f, 0.5f},  {-0.5f, -0.5f, -0.5f},
+
+    {0.5f, 0.5f, -0.5f},   {0.5f, -0.5f, -0.5f},   // right
+    {0.5f, -0.5f, 0.5f},   {0.5f, 0.5f, 0.5f},
+
+    {-0.5f, 0.5f, 0.5f},   {-0.5f, -0.5f, 0.5f},   // left
+    {-0.5f, -0.5f, -0.5f}, {-0.5f, 0.5f, -0.5f}};
+
+// Two triangles per face, relative to the face's first vertex.
+constexpr uint32_t kFaceIndices[6] = {0, 1, 3, 1, 2, 3};
+
+// Color of every cube face but the up one.
+inline const Vec3 kDirtColor = Vec3(0.34, 0.22, 0.24);
+
+enum class IndexFormat { kUInt16, kUInt32 };
+
+struct WeldStats {
+  size_t vertices_before;
+  size_t vertices_after;
 };
 
 class GeometryBuilder {
  public:
   std::vector<Vertex> vertices_;
   std::vector<uint32_t> indices_;
+  // Replaces indices_ once CompactIndices() picked the 16-bit format.
+  std::vector<uint16_t> indices16_;
+  IndexFormat index_format_ = IndexFormat::kUInt32;
+
+  /**
+   * @brief Merges bit-identical vertices (same position, uv and color) and
+   * rewrites indices_ to point at the kept copy, first occurrences keep their
+   * relative order. Must run before CompactIndices().
+   */
+  WeldStats WeldVertices();
+
+  /**
+   * @brief Moves the indices to indices16_ when every vertex can be addressed
+   * with 16 bits. Call it once the mesh is complete, nothing can be pushed
+   * afterwards.
+   * @return The index format the mesh ends up with.
+   */
+  IndexFormat CompactIndices();
+
+  // Index data in the current format, ready for upload.
+  const void* index_data() const;
+  size_t index_count() const;
+  size_t index_size() const;
+
+  /**
+   * @brief Makes room for `faces` more quads (4 vertices and 6 indices each)
+   * so the pushes that follow never reallocate. Meshers count their faces in
+   * a first pass, or pass an estimate, then call this once.
+   */
+  void ReserveFaces(size_t faces);
 
   void PushQuad(float scale = 1, Vec3 pos = {0, 0, 0}, Vec3 color = {0, 0, 1});
 
-  void PushCube(float scale = 1, Vec3 pos = {0, 0, 0}, Vec3 color = {0, 0, 1});
+  // Only the faces whose bit is set in `faces` are emitted, the up face gets
+  // `color` and the other faces the dirt color.
+  void PushCube(float scale = 1, Vec3 pos = {0, 0, 0}, Vec3 color = {0, 0, 1},
+                uint8_t faces = kAllFaces);
+
+  /**
+   * @brief Batched PushCube: cube i is centered on positions[i], scaled by
+   * scales[i] and colored with colors[i]. Corners are computed four cubes at
+   * a time with FourVec3F.
+   * @param scales One scale per cube, or a single scale shared by all cubes.
+   * @param faces One face mask per cube, or empty to emit every face.
+   */
+  void PushCubes(std::span<const Math::Vec3F> positions,
+                 std::span<const float> scales, std::span<const Vec3> colors,
+                 std::span<const uint8_t> faces = {});
+
+  // Emits one face of the axis aligned box going from `min` to `max`, used by
+  // meshers that merge several voxel faces into one quad.
+  void PushBoxFace(CubeFace face, float scale, const float min[3],
+                   const float max[3], Vec3 color);
 };
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <vector>
+
+/**
+ * @brief Keeps the last kWindow latency samples and answers percentile
+ * queries over them.
+ */
+class LatencyStats {
+ public:
+  static constexpr size_t kWindow = 1024;
+
+  void Add(float milliseconds);
+
+  /**
+   * @param fraction Between 0 and 1, 0.99 for the p99.
+   * @return The latency below which `fraction` of the samples fall, 0 when
+   * there are no samples yet.
+   */
+  float Percentile(float fraction) const;
+
+  size_t count() const { return samples_.size(); }
+
+ private:
+  std::vector<float> samples_;
+  size_t next_ = 0;
+};
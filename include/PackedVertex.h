@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "GeometryBuilder.h"
+
+/**
+ * @brief 8 byte voxel vertex, a quarter of Vertex.
+ *
+ * position_face: bits 0-5 x, 6-11 y, 12-17 z of the corner relative to the
+ * chunk origin (0 to 32, in voxels), bits 18-20 the CubeFace, bits 21-22 the
+ * corner of the face (0 to 3, in kCubeCorners order).
+ * material: bits 0-7 the palette index of the voxel, other bits are free.
+ */
+struct PackedVertex {
+  uint32_t position_face;
+  uint32_t material;
+
+  static PackedVertex Pack(int x, int y, int z, CubeFace face, int corner,
+                           uint8_t color_index) {
+    return {static_cast<uint32_t>(x) | static_cast<uint32_t>(y) << 6 |
+                static_cast<uint32_t>(z) << 12 |
+                static_cast<uint32_t>(face) << 18 |
+                static_cast<uint32_t>(corner) << 21,
+            color_index};
+  }
+
+  int x() const { return position_face & 0x3F; }
+  int y() const { return (position_face >> 6) & 0x3F; }
+  int z() const { return (position_face >> 12) & 0x3F; }
+  CubeFace face() const {
+    return static_cast<CubeFace>((position_face >> 18) & 0x7);
+  }
+  int corner() const { return (position_face >> 21) & 0x3; }
+  uint8_t color_index() const { return material & 0xFF; }
+};
+
+static_assert(sizeof(PackedVertex) == 8);
+
+class PackedGeometryBuilder {
+ public:
+  std::vector<PackedVertex> vertices_;
+  std::vector<uint32_t> indices_;
+
+  void ReserveFaces(size_t faces);
+
+  // Same faces and index order as GeometryBuilder::PushCube, for the voxel at
+  // chunk local coordinates (x, y, z).
+  void PushCube(int x, int y, int z, uint8_t color_index,
+                uint8_t faces = kAllFaces);
+
+  // Same as GeometryBuilder::PushBoxFace, with `min` and `max` the corners of
+  // the box in chunk local voxel corner coordinates.
+  void PushBoxFace(CubeFace face, const int min[3], const int max[3],
+                   uint8_t color_index);
+};
+
+/**
+ * @brief CPU reference decoder, gives back the Vertex that GeometryBuilder
+ * emits for the same face corner.
+ * @param origin World voxel coordinates of the chunk origin.
+ * @param palette Up face colors, the other faces get kDirtColor.
+ */
+Vertex UnpackVertex(PackedVertex vertex, const int origin[3], float scale,
+                    const std::vector<Vec3>& palette);
+
+GeometryBuilder UnpackMesh(const PackedGeometryBuilder& mesh,
+                           const int origin[3], float scale,
+                           const std::vector<Vec3>& palette);
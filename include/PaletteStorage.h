@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <span>
+#include <vector>
+
+// Material id stored per voxel, 0 is always air.
+using VoxelId = uint8_t;
+constexpr VoxelId kAir = 0;
+
+/**
+ * @brief Fixed size array of voxels stored as indices into a small palette
+ * of the distinct ids it holds.
+ *
+ * Indices take 0 bits while the array is uniform, then 1, 2, 4 or 8 bits as
+ * the palette grows past 1, 2, 4 and 16 entries; the array is repacked
+ * automatically when that happens. Indices never straddle two words.
+ */
+class PaletteStorage {
+ public:
+  explicit PaletteStorage(size_t size, VoxelId fill = kAir);
+
+  VoxelId Get(size_t index) const {
+    if (bits_ == 0) {
+      return palette_[0];
+    }
+    size_t bit = index * bits_;
+    uint64_t word = words_[bit >> 6];
+    return palette_[(word >> (bit & 63)) & ((1ull << bits_) - 1)];
+  }
+
+  void Set(size_t index, VoxelId id);
+
+  // Bulk copy of `count` voxels starting at `first` into `out`.
+  void GetRange(size_t first, size_t count, VoxelId* out) const;
+  // Bulk fill of `count` voxels starting at `first` with `id`.
+  void SetRange(size_t first, size_t count, VoxelId id);
+
+  // Number of voxels equal to `id`.
+  size_t Count(VoxelId id) const;
+
+  /**
+   * @brief Drops the palette entries no voxel uses anymore, which can lower
+   * the bits per index.
+   */
+  void Compact();
+
+  /**
+   * @brief Replaces the content with raw palette and index words, as given
+   * by palette() and words() of a storage of the same size.
+   * @return False, leaving the storage untouched, when they are inconsistent.
+   */
+  bool Assign(int bits, std::span<const VoxelId> palette,
+              std::span<const uint64_t> words);
+
+  size_t size() const { return size_; }
+  const std::vector<uint64_t>& words() const { return words_; }
+  int bits_per_index() const { return bits_; }
+  const std::vector<VoxelId>& palette() const { return palette_; }
+  size_t memory_usage() const {
+    return palette_.size() * sizeof(VoxelId) + words_.size() * sizeof(uint64_t);
+  }
+
+ private:
+  // Palette index of `id`, added to the palette (and repacking the indices
+  // if needed) when missing.
+  uint32_t IndexOf(VoxelId id);
+  void Repack(int bits);
+  void SetIndex(size_t index, uint32_t palette_index);
+  uint32_t GetIndex(size_t index) const;
+
+  size_t size_;
+  int bits_ = 0;
+  std::vector<VoxelId> palette_;
+  std::vector<uint64_t> words_;
+};
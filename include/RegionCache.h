@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ChunkGrid.h"
+#include "MappedFile.h"
+#include "TerrainGenerator.h"
+
+// Region files hold kRegionSize x kRegionSize chunk columns.
+constexpr int kRegionShift = 4;
+constexpr int kRegionSize = 1 << kRegionShift;
+
+/**
+ * @brief On-disk cache of generated chunk columns, their voxels and meshes,
+ * so a column generated once is mapped back instead of generated again.
+ *
+ * A region file starts with a fixed header and one slot per column, then
+ * the column records, every field 8 byte aligned so records are read in
+ * place from the mapping. Files are named after the generator key: a seed,
+ * generator version or settings change starts from empty files. Meshes are
+ * only given back when they were built with the current mesh settings, and
+ * they assume unedited neighbors. Safe to use from several threads.
+ */
+class RegionCache {
+ public:
+  RegionCache(std::string directory, const TerrainGenerator& generator,
+              const ChunkGrid& grid);
+
+  /**
+   * @brief Loads every chunk of a cached column.
+   * @param meshed Set when the meshes of the chunks were loaded too,
+   * otherwise only their voxels were. Left alone when loading fails.
+   * @return False when the column is not cached, or unreadable.
+   */
+  bool LoadColumn(ColumnCoord coord, std::vector<std::pair<int, Chunk>>& chunks,
+                  bool* meshed);
+
+  /**
+   * @brief Appends a column to its region file, replacing any previous copy.
+   * @param meshed Whether the meshes of the chunks are stored too.
+   */
+  bool StoreColumn(ColumnCoord coord,
+                   const std::vector<std::pair<int, const Chunk*>>& chunks,
+                   bool meshed);
+
+  // Everything the generated voxels depend on.
+  static uint64_t GeneratorKey(const TerrainGenerator& generator);
+  // Everything the meshes depend on, besides the voxels.
+  static uint64_t MeshKey(const ChunkGrid& grid);
+
+ private:
+  struct Region {
+    MappedFile file;
+    // The file changed since it was mapped.
+    bool stale = true;
+  };
+
+  std::string RegionPath(int rx, int rz) const;
+  // Maps the region file if needed, null when it does not exist.
+  const MappedFile* MapRegion(int rx, int rz);
+
+  std::string directory_;
+  uint64_t seed_;
+  uint64_t generator_key_;
+  uint64_t mesh_key_;
+
+  std::mutex mutex_;
+  std::unordered_map<ColumnCoord, std::unique_ptr<Region>, ColumnCoordHash>
+      regions_;
+};
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "ChunkGrid.h"
+#include "GeometryBuilder.h"
+#include "ThreadPool.h"
+
+constexpr VoxelId kGrassLight = 1;
+constexpr VoxelId kGrassDark = 2;
+
+// Heights of the 32x32 voxel columns of one chunk column.
+struct ChunkColumn {
+  int cx;
+  int cz;
+  int top_y;  // one past the highest solid voxel
+  float heights[kChunkSize * kChunkSize];  // -INFINITY outside the terrain
+};
+
+// What a chunk holds, as far as the noise bounds can tell.
+enum class ChunkFill : uint8_t {
+  kAir,
+  kSolid,  // every voxel, with the column materials
+  kMixed,  // anything, the voxels have to be evaluated
+};
+
+/**
+ * @brief Fills a ChunkGrid with the noise heightfield terrain, columns are
+ * split across the workers of a ThreadPool.
+ */
+class TerrainGenerator {
+ public:
+  // Bump whenever the voxels generated for a given seed and settings change,
+  // chunks cached by an older version are then ignored.
+  static constexpr uint32_t kVersion = 1;
+
+  // Spacing in voxels of the 3D noise lattice of FillDensityChunk().
+  static constexpr int kDensityStep = 4;
+
+  uint64_t seed_;
+  Perlin perlin_;
+
+  // The terrain is a size_xz_ x size_xz_ patch of columns centered on the
+  // origin, each column filled from min_y_ up to its noise height. It has no
+  // bounds when size_xz_ is 0, for streaming.
+  int size_xz_ = 100;
+  int size_y_ = 20;
+  int min_y_ = -5;
+
+  // Amplitude in voxels of 3D noise added to the height of every voxel, so
+  // the surface folds into overhangs and caves open under it. 0 keeps a
+  // plain heightfield.
+  float overhang_amplitude_ = 0;
+  // Frequency of that noise, per voxel.
+  float overhang_frequency_ = 0.08f;
+
+  // The checkerboard keeps greedy meshing from merging any top face, leave it
+  // off unless the individual voxels need to be visible.
+  bool checkerboard_ = false;
+
+  // Random seed, the world differs on every run.
+  TerrainGenerator();
+  explicit TerrainGenerator(uint64_t seed);
+
+  /**
+   * @brief Height of the column at patch coordinates (x, z), every voxel
+   * with min_y_ <= y < height is solid.
+   */
+  float ColumnHeight(int x, int z) const;
+
+  VoxelId ColumnMaterial(int x, int z) const;
+
+  /**
+   * @brief Heights of a size_x x size_z rectangle of columns, the same as
+   * ColumnHeight() but evaluated one noise layer at a time over the whole
+   * rectangle. Safe to call from any thread.
+   * @param x0, z0 World coordinates of the first column.
+   * @param heights Receives the height of column (x0 + i, z0 + k) at
+   * i * size_z + k, -INFINITY outside the terrain.
+   */
+  void ComputeHeights(int x0, int z0, int size_x, int size_z,
+                      float* heights) const;
+
+  /**
+   * @brief Conservative bounds of the heights ComputeHeights() gives for the
+   * same rectangle, from the noise lattice alone. Columns outside the
+   * terrain are not accounted for.
+   */
+  NoiseBounds HeightBounds(int x0, int z0, int size_x, int size_z) const;
+
+  /**
+   * @brief Classifies chunk (cx, cy, cz) from HeightBounds() and the
+   * overhang amplitude, without evaluating any voxel. kMixed whenever the
+   * bounds cannot tell, never kAir or kSolid for a chunk that is not.
+   */
+  ChunkFill ClassifyChunk(int cx, int cy, int cz) const;
+
+  // Computes the heights of chunk column (cx, cz), safe to call from any
+  // thread.
+  void ComputeColumn(int cx, int cz, ChunkColumn& column) const;
+
+  /**
+   * @brief Fills chunk `cy` of a column whose heights were computed, the
+   * chunk is expected to be all air. Chunks ClassifyChunk() finds all air or
+   * all solid are filled without evaluating their voxels. The octree of the
+   * chunk is up to date on return.
+   */
+  void FillChunk(const ChunkColumn& column, int cy, Chunk& chunk) const;
+
+  // Range of chunk y coordinates of a column holding solid voxels, empty
+  // when max < min.
+  int MinChunkY() const { return min_y_ >> kChunkShift; }
+  int MaxChunkY(const ChunkColumn& column) const {
+    return column.top_y <= min_y_ ? MinChunkY() - 1
+                                  : (column.top_y - 1) >> kChunkShift;
+  }
+
+  /**
+   * @brief Generates the whole patch into `grid`, the touched chunks are left
+   * dirty so the next RebuildDirty() meshes them. In kHeightfield mode
+   * without overhangs or LODs they are meshed from the column heights
+   * instead, and left clean.
+   */
+  void Generate(ChunkGrid& grid, ThreadPool& pool);
+
+ private:
+  // FillChunk() without the octree.
+  void FillVoxels(const ChunkColumn& column, int cy, Chunk& chunk) const;
+
+  /**
+   * @brief FillVoxels() with overhangs: a voxel is solid where its density,
+   * the column height above it plus the 3D noise, is positive. The noise
+   * is sampled every kDensityStep voxels and interpolated in between.
+   */
+  void FillDensityChunk(const ChunkColumn& column, int cy, Chunk& chunk) const;
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Fixed set of worker threads pulling jobs from a shared queue.
+ */
+class ThreadPool {
+ public:
+  explicit ThreadPool(
+      size_t thread_count = std::thread::hardware_concurrency());
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  /**
+   * @brief Queues a job, it runs on the first idle worker.
+   */
+  void Submit(std::function<void()> job);
+
+  /**
+   * @brief Calls fn(i) for every i in [0, count) on the workers and the
+   * calling thread, and returns once every call is done.
+   */
+  void ParallelFor(size_t count, const std::function<void(size_t)>& fn);
+
+  size_t thread_count() const { return workers_.size(); }
+
+ private:
+  void WorkerLoop();
+
+  std::vector<std::thread> workers_;
+  std::deque<std::function<void()>> jobs_;
+  std::mutex mutex_;
+  std::condition_variable job_available_;
+  bool stopping_ = false;
+};
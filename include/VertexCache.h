@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <span>
+#include <vector>
+
+// Cache size of most GPUs post-transform caches, used as the default target.
+constexpr size_t kDefaultVertexCacheSize = 16;
+
+struct VertexCacheStats {
+  // Average cache miss ratio: transformed vertices per triangle, 0.5 at best
+  // for large regular grids and 3 at worst.
+  float acmr;
+  // Average transformed vertex ratio: transformed vertices per referenced
+  // vertex, 1 at best.
+  float atvr;
+};
+
+/**
+ * @brief Simulates a FIFO post-transform vertex cache over a triangle list.
+ * @param vertex_count Number of vertices the indices point into.
+ */
+VertexCacheStats SimulateVertexCache(
+    std::span<const uint32_t> indices, size_t vertex_count,
+    size_t cache_size = kDefaultVertexCacheSize);
+
+/**
+ * @brief Reorders the triangles of a triangle list for a post-transform
+ * cache of `cache_size` entries, with Tipsify (Sander, Nehab and Barczak,
+ * "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw").
+ * Triangles keep their winding, vertices are not moved.
+ */
+void OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertex_count,
+                         size_t cache_size = kDefaultVertexCacheSize);
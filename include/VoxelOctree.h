@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "PaletteStorage.h"
+
+/**
+ * @brief Sparse voxel octree over a cube of voxels, every uniform region
+ * (all air or all one material) is a single leaf whatever its size.
+ *
+ * The children of a node are 8 consecutive nodes, octant i holding the
+ * half with x >= half when bit 0 is set, y for bit 1 and z for bit 2.
+ */
+class VoxelOctree {
+ public:
+  // A cube of `size` voxels (a power of two) of air.
+  explicit VoxelOctree(int size);
+
+  /**
+   * @brief Rebuilds the tree from `voxels`, laid out like Chunk::Index().
+   * Also drops the free blocks left behind by Set().
+   */
+  void Build(const PaletteStorage& voxels);
+
+  VoxelId Get(int x, int y, int z) const;
+  // Splits the leaf holding the voxel down to it and merges uniform
+  // siblings back on the way up.
+  void Set(int x, int y, int z, VoxelId id);
+
+  /**
+   * @brief Finds the leaf holding a voxel.
+   * @param min Receives the corner of the leaf with the smallest coordinates.
+   * @return The size of the leaf, 1 for a lone voxel.
+   */
+  int FindLeaf(int x, int y, int z, int min[3], VoxelId* id) const;
+
+  // Whether any voxel of the box [min, max) is solid, empty subtrees are
+  // skipped whole.
+  bool AnySolid(const int min[3], const int max[3]) const;
+
+  /**
+   * @brief Calls visit(x, y, z, size, id) for every leaf that is not air,
+   * (x, y, z) being its smallest corner.
+   */
+  template <typename Visit>
+  void ForEachSolidLeaf(Visit&& visit) const {
+    VisitSolid(0, 0, 0, 0, size_, visit);
+  }
+
+  bool IsUniform() const { return nodes_[0].children == kLeaf; }
+  VoxelId root_id() const { return nodes_[0].id; }
+  int size() const { return size_; }
+  size_t node_count() const { return nodes_.size() - free_.size() * 8; }
+  size_t memory_usage() const { return nodes_.size() * sizeof(Node); }
+
+ private:
+  static constexpr uint32_t kLeaf = UINT32_MAX;
+
+  struct Node {
+    // Index of the first of the 8 children, kLeaf for a uniform node.
+    uint32_t children;
+    // Voxel of the whole node when it is a leaf.
+    VoxelId id;
+  };
+
+  static int Octant(int x, int y, int z, int half) {
+    return (x & half ? 1 : 0) | (y & half ? 2 : 0) | (z & half ? 4 : 0);
+  }
+
+  uint32_t AllocateChildren(VoxelId id);
+
+  template <typename Visit>
+  void VisitSolid(uint32_t node, int x, int y, int z, int size,
+                  Visit& visit) const {
+    const Node& n = nodes_[node];
+    if (n.children == kLeaf) {
+      if (n.id != kAir) {
+        visit(x, y, z, size, n.id);
+      }
+      return;
+    }
+    int half = size / 2;
+    for (int octant = 0; octant < 8; octant++) {
+      VisitSolid(n.children + octant, x + (octant & 1 ? half : 0),
+                 y + (octant & 2 ? half : 0), z + (octant & 4 ? half : 0),
+                 half, visit);
+    }
+  }
+
+  bool AnySolid(uint32_t node, const int origin[3], int size, const int min[3],
+                const int max[3]) const;
+
+  int size_;
+  std::vector<Node> nodes_;
+  // First child of the blocks of 8 nodes freed by merges, reused by splits.
+  std::vector<uint32_t> free_;
+};
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ChunkGrid.h"
+#include "RegionCache.h"
+#include "TerrainGenerator.h"
+#include "ThreadPool.h"
+
+/**
+ * @brief Keeps the chunk columns around the camera generated and meshed.
+ *
+ * Generation and meshing run as jobs on a ThreadPool, nearest first and
+ * chunks in front of the camera before those behind it. Their results are
+ * merged into the grid by Update() on the calling thread, which also evicts
+ * the least recently used columns out of view when the loaded chunks go over
+ * the memory budget. Edits still go through ChunkGrid::SetVoxel() and
+ * RebuildDirty().
+ */
+class WorldStreamer {
+ public:
+  // Horizontal radius, in chunks, of the columns loaded around the camera.
+  int view_radius_ = 8;
+  // Chunks behind the camera are queued as if this many times farther.
+  float behind_weight_ = 2;
+  // Voxels, octrees and meshes of the loaded chunks, in bytes.
+  size_t memory_budget_ = 256 << 20;
+  // Jobs queued at once. Kept low so the queue follows the camera instead of
+  // finishing the requests of where it was.
+  size_t max_jobs_in_flight_ = 8;
+  // Optional. Columns are loaded from it before being generated, and stored
+  // to it once meshed with all their neighbors around unless edited.
+  RegionCache* cache_ = nullptr;
+
+  // `grid` and `generator` must outlive the streamer, `generator` must not
+  // change while it runs.
+  WorldStreamer(ChunkGrid& grid, const TerrainGenerator& generator,
+                ThreadPool& pool);
+  // Waits for the jobs in flight.
+  ~WorldStreamer();
+
+  WorldStreamer(const WorldStreamer&) = delete;
+  WorldStreamer& operator=(const WorldStreamer&) = delete;
+
+  /**
+   * @brief Publishes the finished jobs, queues new ones and evicts columns.
+   * @param camera_front Normalized view direction.
+   * @return The chunks whose meshes changed or that were evicted, to upload
+   * again like a RebuildDirty() patch.
+   */
+  RemeshPatch Update(const Math::Vec3F& camera_position,
+                     const Math::Vec3F& camera_front);
+
+  // Memory used by the loaded chunks as of the last Update().
+  size_t memory_usage() const { return memory_usage_; }
+  size_t loaded_column_count() const { return columns_.size(); }
+
+ private:
+  struct Column {
+    bool loaded = false;  // false while its generation job runs
+    uint64_t last_used = 0;  // last Update() it was in view
+    std::vector<int> chunk_ys;
+    // Meshes loaded from the cache, built with every neighbor around, so
+    // neighbors loading later do not change them.
+    bool cached_mesh = false;
+    // In the cache already, or being written to it.
+    bool stored = false;
+    // A chunk was edited before the column got stored, it never will be.
+    bool edited = false;
+  };
+
+  struct GeneratedColumn {
+    ColumnCoord coord;
+    std::vector<std::pair<int, Chunk>> chunks;
+    // Loaded from the cache with its meshes.
+    bool meshed = false;
+  };
+
+  struct MeshedChunk {
+    ChunkCoord coord;
+    uint32_t revision;
+    Chunk chunk;
+  };
+
+  // Lower goes first.
+  float Priority(ColumnCoord column) const;
+  bool InView(ColumnCoord column) const;
+  // Whether the neighbors of the column that will ever load have loaded, so
+  // its chunks are not meshed twice.
+  bool NeighborsSettled(ColumnCoord column) const;
+  // Requests new meshes for the loaded neighbors of the column, except those
+  // with cached meshes unless `include_cached`.
+  void MarkNeighborsForMeshing(ColumnCoord column, bool include_cached);
+
+  void Publish(RemeshPatch& patch);
+  void QueueGeneration();
+  void QueueMeshing();
+  void QueueStores();
+  void Evict(RemeshPatch& patch);
+
+  ChunkGrid& grid_;
+  const TerrainGenerator& generator_;
+  ThreadPool& pool_;
+
+  std::unordered_map<ColumnCoord, Column, ColumnCoordHash> columns_;
+  // Chunks waiting for a mesh job, and those with one running.
+  std::unordered_set<ChunkCoord, ChunkCoordHash> mesh_requests_;
+  std::unordered_set<ChunkCoord, ChunkCoordHash> meshing_;
+  uint64_t tick_ = 0;
+  ColumnCoord camera_column_ = {0, 0};
+  float camera_x_ = 0;  // in chunks
+  float camera_z_ = 0;
+  float front_x_ = 0;  // horizontal view direction, normalized
+  float front_z_ = 0;
+  size_t memory_usage_ = 0;
+
+  // Shared with the jobs.
+  std::mutex mutex_;
+  std::condition_variable idle_;
+  size_t jobs_in_flight_ = 0;
+  std::vector<GeneratedColumn> generated_;
+  std::vector<MeshedChunk> meshed_;
+};
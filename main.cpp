@@ -3,7 +3,12 @@
 #include <DirectXMath.h>
 
 #include "Camera.h"
+#include "ChunkGrid.h"
 #include "GeometryBuilder.h"
+#include "TerrainGenerator.h"
+#include "RegionCache.h"
+#include "ThreadPool.h"
+#include "WorldStreamer.h"
 
 #define COBJMACROS
 #define WIN32_LEAN_AND_MEAN
@@ -18,8 +23,12 @@
 #include <float.h>
 #include <math.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 
+#include <algorithm>
+#include <unordered_map>
+
 // replace this with your favorite Assert() implementation
 #include <intrin.h>
 #define Assert(cond)             \
@@ -45,31 +54,86 @@ bool firstMouse = true;
 bool is_cursor_hidden = false;
 
 bool keys_pressed_[6] = {false};
-Perlin perlin;
-;  // namespace Input
-GeometryBuilder Update() {
-  GeometryBuilder geom;
-  int sizeXZ = 100;
-  int sizeY = 20;
-  int offset = 2;
-
-  float tileSize = 0.2f;
-  for (int x = 0; x < sizeXZ; x++) {
-    for (int z = 0; z < sizeXZ; z++) {
-      Vec3 color = (x + z) % 2 == 0 ? Vec3(0, 0.8, 0) : Vec3(0, 0.5, 0);
-      float secondary_noise = +perlin.perlin2d(x, z, 0.11f, 1);
-      auto perl = perlin.perlin2d(x + 100, z, 0.03f, 3) * sizeY;
-      perl -= 10;
-      perl += secondary_noise * 4;
-
-      for (int y = -5; y < perl; y++) {
-        Vec3 position = Vec3(-sizeXZ / 2, 0, -sizeXZ / 2) + Vec3(x, y, z);
-
-        geom.PushCube(tileSize, position, color);
-      }
+bool dig_requested_ = false;
+
+struct MeshBuffers {
+  ID3D11Buffer* vbuffer = NULL;
+  ID3D11Buffer* ibuffer = NULL;
+  UINT index_count = 0;
+  DXGI_FORMAT index_format = DXGI_FORMAT_R32_UINT;
+};
+
+// One set of buffers per LOD level, levels that were not built stay empty.
+struct ChunkBuffers {
+  MeshBuffers lods[kLodCount];
+};
+
+using ChunkBufferMap =
+    std::unordered_map<ChunkCoord, ChunkBuffers, ChunkCoordHash>;
+
+static void ReleaseChunkBuffers(ChunkBuffers& buffers) {
+  for (MeshBuffers& lod : buffers.lods) {
+    if (lod.vbuffer) lod.vbuffer->Release();
+    if (lod.ibuffer) lod.ibuffer->Release();
+  }
+  buffers = ChunkBuffers();
+}
+
+static void UploadMesh(ID3D11Device* device, const GeometryBuilder& mesh,
+                       MeshBuffers& buffers) {
+  if (mesh.index_count() == 0) {
+    return;
+  }
+
+  {
+    D3D11_BUFFER_DESC desc = {
+        .ByteWidth = static_cast<UINT>(mesh.vertices_.size() *
+            sizeof(mesh.vertices_[0])),
+        .Usage = D3D11_USAGE_IMMUTABLE,
+        .BindFlags = D3D11_BIND_VERTEX_BUFFER,
+    };
+
+    D3D11_SUBRESOURCE_DATA initial = {.pSysMem = mesh.vertices_.data()};
+    device->CreateBuffer(&desc, &initial, &buffers.vbuffer);
+  }
+
+  {
+    D3D11_BUFFER_DESC desc = {
+        .ByteWidth =
+        static_cast<UINT>(mesh.index_count() * mesh.index_size()),
+        .Usage = D3D11_USAGE_IMMUTABLE,
+        .BindFlags = D3D11_BIND_INDEX_BUFFER,
+    };
+
+    D3D11_SUBRESOURCE_DATA initial = {.pSysMem = mesh.index_data()};
+    device->CreateBuffer(&desc, &initial, &buffers.ibuffer);
+  }
+
+  buffers.index_count = static_cast<UINT>(mesh.index_count());
+  buffers.index_format = mesh.index_format_ == IndexFormat::kUInt16
+                             ? DXGI_FORMAT_R16_UINT
+                             : DXGI_FORMAT_R32_UINT;
+}
+
+// Recreates the GPU buffers of the patched chunks only, every other chunk
+// keeps its buffers untouched.
+static void UploadChunks(ID3D11Device* device, const ChunkGrid& grid,
+                         const RemeshPatch& patch,
+                         ChunkBufferMap& chunk_buffers) {
+  for (const ChunkCoord& coord : patch.chunks) {
+    ChunkBuffers& buffers = chunk_buffers[coord];
+    ReleaseChunkBuffers(buffers);
+
+    const Chunk* chunk = grid.FindChunk(coord);
+    if (chunk == NULL || chunk->mesh_.index_count() == 0) {
+      chunk_buffers.erase(coord);
+      continue;
+    }
+
+    for (int lod = 0; lod < kLodCount; lod++) {
+      UploadMesh(device, chunk->Mesh(lod), buffers.lods[lod]);
     }
   }
-  return geom;
 }
 
 static void FatalError(const char* message) {
@@ -129,6 +193,9 @@ static LRESULT CALLBACK WindowProc(HWND wnd, UINT msg, WPARAM wparam,
         case VK_CONTROL:
           keys_pressed_[5] = true;
           return 0;
+        case 'F':
+          dig_requested_ = true;
+          return 0;
       }
       return 0;
     case WM_KEYUP:
@@ -313,33 +380,29 @@ int WINAPI WinMain(HINSTANCE instance, HINSTANCE previnstance, LPSTR cmdline,
     dxgiDevice->Release();
   }
 
-  GeometryBuilder geom_ = Update();
-
-  ID3D11Buffer* vbuffer;
-  {
-    D3D11_BUFFER_DESC desc = {
-        .ByteWidth = static_cast<UINT>(geom_.vertices_.size() *
-            sizeof(geom_.vertices_[0])),
-        .Usage = D3D11_USAGE_IMMUTABLE,
-        .BindFlags = D3D11_BIND_VERTEX_BUFFER,
-    };
-
-    D3D11_SUBRESOURCE_DATA initial = {.pSysMem = geom_.vertices_.data()};
-    device->CreateBuffer(&desc, &initial, &vbuffer);
-  }
-
-  ID3D11Buffer* ibuffer;
-  {
-    D3D11_BUFFER_DESC desc = {
-        .ByteWidth =
-        static_cast<UINT>(geom_.indices_.size() * sizeof(uint32_t)),
-        .Usage = D3D11_USAGE_IMMUTABLE,
-        .BindFlags = D3D11_BIND_INDEX_BUFFER,
-    };
-
-    D3D11_SUBRESOURCE_DATA initial = {.pSysMem = geom_.indices_.data()};
-    device->CreateBuffer(&desc, &initial, &ibuffer);
-  }
+  ThreadPool pool_;
+  ChunkGrid grid_(0.2f);
+  grid_.mesh_mode_ = MeshMode::kGreedy;
+  grid_.weld_vertices_ = true;
+  grid_.optimize_vertex_cache_ = true;
+  grid_.ambient_occlusion_ = true;
+  grid_.build_lods_ = true;
+  grid_.palette_ = {Vec3(0, 0, 0), Vec3(0, 0.8, 0), Vec3(0, 0.5, 0)};
+
+  // the terrain has no bounds, chunks around the camera are generated and
+  // meshed in the background by the streamer on its own workers, so edits
+  // remeshed on pool_ never wait behind them
+  TerrainGenerator terrain_(1337);
+  terrain_.size_xz_ = 0;
+  terrain_.overhang_amplitude_ = 16;
+  ThreadPool stream_pool_(
+      std::max(1u, std::thread::hardware_concurrency() / 2));
+  // columns generated by a previous run are mapped back from disk
+  RegionCache cache_("cache", terrain_, grid_);
+  WorldStreamer streamer_(grid_, terrain_, stream_pool_);
+  streamer_.cache_ = &cache_;
+
+  ChunkBufferMap chunk_buffers_;
 
   // vertex & pixel shaders for drawing triangle, plus input layout for vertex
   // input
@@ -745,12 +808,6 @@ int WINAPI WinMain(HINSTANCE instance, HINSTANCE previnstance, LPSTR cmdline,
       // Input Assembler
       context->IASetInputLayout(layout);
       context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-      UINT stride = sizeof(struct Vertex);
-      UINT offset = 0;
-      context->IASetVertexBuffers(0, 1, &vbuffer, &stride, &offset);
-      UINT ioffset = 0;
-      context->IASetIndexBuffer(ibuffer, DXGI_FORMAT_R32_UINT, 0);
-
       // Vertex Shader
       context->VSSetConstantBuffers(0, 1, &ubuffer);
       context->VSSetShader(vshader, NULL, 0);
@@ -769,8 +826,44 @@ int WINAPI WinMain(HINSTANCE instance, HINSTANCE previnstance, LPSTR cmdline,
       context->OMSetDepthStencilState(depthState, 0);
       context->OMSetRenderTargets(1, &rtView, dsView);
 
-      // draw 3 vertices
-      context->DrawIndexed(geom_.indices_.size(), 0, 0);
+      // F removes the voxel the camera looks at
+      if (dig_requested_) {
+        dig_requested_ = false;
+        RaycastHit hit;
+        if (grid_.Raycast(cam_.position_, cam_.front_, 20.0f, &hit)) {
+          grid_.ClearVoxel(hit.voxel[0], hit.voxel[1], hit.voxel[2]);
+        }
+      }
+
+      // upload the chunks the streamer finished meshing or evicted
+      UploadChunks(device, grid_,
+                   streamer_.Update(cam_.position_, cam_.front_),
+                   chunk_buffers_);
+
+      // remesh and re-upload only the chunks that changed since last frame
+      RemeshPatch patch = grid_.RebuildDirty(&pool_);
+      UploadChunks(device, grid_, patch, chunk_buffers_);
+      if (!patch.chunks.empty()) {
+        printf("remeshed %zu chunks in %.2f ms, p99 per chunk %.2f ms\n",
+               patch.chunks.size(), patch.milliseconds,
+               grid_.remesh_latency().Percentile(0.99f));
+      }
+
+      // draw every chunk with its own vertex & index buffer, at the LOD
+      // level matching its distance to the camera
+      UINT stride = sizeof(struct Vertex);
+      UINT offset = 0;
+      for (auto& [coord, buffers] : chunk_buffers_) {
+        int lod = grid_.SelectLod(coord, cam_.position_);
+        while (lod > 0 && buffers.lods[lod].index_count == 0) {
+          lod--;
+        }
+
+        MeshBuffers& mesh = buffers.lods[lod];
+        context->IASetVertexBuffers(0, 1, &mesh.vbuffer, &stride, &offset);
+        context->IASetIndexBuffer(mesh.ibuffer, mesh.index_format, 0);
+        context->DrawIndexed(mesh.index_count, 0, 0);
+      }
     }
 
     // change to FALSE to disable vsync
@@ -0,0 +1,941 @@
+#include "ChunkGrid.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cmath>
+
+#include "ColumnOccupancy.h"
+#include "VertexCache.h"
+
+size_t ChunkCoordHash::operator()(const ChunkCoord& coord) const {
+  size_t h = static_cast<uint32_t>(coord.x) * 73856093u;
+  h ^= static_cast<uint32_t>(coord.y) * 19349663u;
+  h ^= static_cast<uint32_t>(coord.z) * 83492791u;
+  return h;
+}
+
+size_t Chunk::memory_usage() const {
+  size_t bytes = voxels_.memory_usage() + octree_.memory_usage();
+  for (int lod = 0; lod < kLodCount; lod++) {
+    const GeometryBuilder& mesh = Mesh(lod);
+    bytes += mesh.vertices_.size() * sizeof(Vertex) +
+             mesh.index_count() * mesh.index_size();
+  }
+  return bytes;
+}
+
+size_t ColumnCoordHash::operator()(const ColumnCoord& coord) const {
+  size_t h = static_cast<uint32_t>(coord.x) * 73856093u;
+  h ^= static_cast<uint32_t>(coord.z) * 83492791u;
+  return h;
+}
+
+ChunkGrid::ChunkGrid(float voxel_scale) : voxel_scale_(voxel_scale) {}
+
+VoxelId ChunkGrid::GetVoxel(int x, int y, int z) const {
+  const Chunk* chunk = FindChunk(ToChunkCoord(x, y, z));
+  if (chunk == nullptr) {
+    return kAir;
+  }
+  return chunk->Get(x & kChunkMask, y & kChunkMask, z & kChunkMask);
+}
+
+void ChunkGrid::SetVoxel(int x, int y, int z, VoxelId id) {
+  ChunkCoord coord = ToChunkCoord(x, y, z);
+  Chunk* chunk = FindChunk(coord);
+  if (chunk == nullptr) {
+    if (id == kAir) {
+      return;
+    }
+    chunk = &chunks_[coord];
+  }
+
+  int lx = x & kChunkMask;
+  int ly = y & kChunkMask;
+  int lz = z & kChunkMask;
+  if (chunk->Get(lx, ly, lz) == id) {
+    return;
+  }
+  chunk->Set(lx, ly, lz, id);
+  chunk->dirty_ = true;
+  chunk->edited_ = true;
+  chunk->revision_++;
+
+  // Neighbors that hold this voxel in their padded border see it change too.
+  int min_dx = lx == 0 ? -1 : 0, max_dx = lx == kChunkMask ? 1 : 0;
+  int min_dy = ly == 0 ? -1 : 0, max_dy = ly == kChunkMask ? 1 : 0;
+  int min_dz = lz == 0 ? -1 : 0, max_dz = lz == kChunkMask ? 1 : 0;
+  for (int dx = min_dx; dx <= max_dx; dx++) {
+    for (int dy = min_dy; dy <= max_dy; dy++) {
+      for (int dz = min_dz; dz <= max_dz; dz++) {
+        Chunk* neighbor =
+            FindChunk({coord.x + dx, coord.y + dy, coord.z + dz});
+        if (neighbor != nullptr) {
+          neighbor->dirty_ = true;
+          neighbor->edited_ = true;
+          neighbor->revision_++;
+        }
+      }
+    }
+  }
+}
+
+Chunk* ChunkGrid::FindChunk(ChunkCoord coord) {
+  auto it = chunks_.find(coord);
+  return it == chunks_.end() ? nullptr : &it->second;
+}
+
+const Chunk* ChunkGrid::FindChunk(ChunkCoord coord) const {
+  auto it = chunks_.find(coord);
+  return it == chunks_.end() ? nullptr : &it->second;
+}
+
+Chunk& ChunkGrid::GetOrCreateChunk(ChunkCoord coord) {
+  return chunks_[coord];
+}
+
+bool ChunkGrid::Raycast(const Math::Vec3F& origin,
+                        const Math::Vec3F& direction, float max_distance,
+                        RaycastHit* hit) const {
+  // In voxel units, shifted so that voxel v spans [v, v + 1) on each axis.
+  const float o[3] = {origin.X / voxel_scale_ + 0.5f,
+                      origin.Y / voxel_scale_ + 0.5f,
+                      origin.Z / voxel_scale_ + 0.5f};
+  const float d[3] = {direction.X, direction.Y, direction.Z};
+  const float max_t = max_distance / voxel_scale_;
+  // Face entered when stepping forward along each axis, and backward.
+  constexpr CubeFace kEnterForward[3] = {kFaceLeft, kFaceDown, kFaceBack};
+  constexpr CubeFace kEnterBackward[3] = {kFaceRight, kFaceUp, kFaceFront};
+
+  int voxel[3];
+  for (int axis = 0; axis < 3; axis++) {
+    voxel[axis] = static_cast<int>(std::floor(o[axis]));
+  }
+  CubeFace face = kFaceCount;
+  float t = 0;
+
+  while (t <= max_t) {
+    // Largest uniform box around the voxel: a whole missing chunk, or the
+    // octree leaf holding it.
+    ChunkCoord coord = ToChunkCoord(voxel[0], voxel[1], voxel[2]);
+    int box_min[3] = {coord.x * kChunkSize, coord.y * kChunkSize,
+                      coord.z * kChunkSize};
+    int box_size = kChunkSize;
+    const Chunk* chunk = FindChunk(coord);
+    if (chunk != nullptr) {
+      int leaf_min[3];
+      VoxelId id;
+      box_size = chunk->octree_.FindLeaf(
+          voxel[0] & kChunkMask, voxel[1] & kChunkMask, voxel[2] & kChunkMask,
+          leaf_min, &id);
+      if (id != kAir) {
+        *hit = {{voxel[0], voxel[1], voxel[2]}, face, t * voxel_scale_};
+        return true;
+      }
+      for (int axis = 0; axis < 3; axis++) {
+        box_min[axis] += leaf_min[axis];
+      }
+    }
+
+    // Leave the box through its nearest exit plane.
+    int exit_axis = -1;
+    float exit_t = INFINITY;
+    for (int axis = 0; axis < 3; axis++) {
+      if (d[axis] == 0) {
+        continue;
+      }
+      float plane = d[axis] > 0 ? box_min[axis] + box_size : box_min[axis];
+      float plane_t = (plane - o[axis]) / d[axis];
+      if (plane_t < exit_t) {
+        exit_t = plane_t;
+        exit_axis = axis;
+      }
+    }
+    if (exit_axis < 0) {
+      return false;
+    }
+
+    t = std::max(t, exit_t);
+    for (int axis = 0; axis < 3; axis++) {
+      if (axis == exit_axis) {
+        voxel[axis] = d[axis] > 0 ? box_min[axis] + box_size
+                                  : box_min[axis] - 1;
+      } else {
+        // Clamped to the box so rounding never skips a neighbor.
+        int v = static_cast<int>(std::floor(o[axis] + d[axis] * t));
+        voxel[axis] = std::clamp(v, box_min[axis],
+                                 box_min[axis] + box_size - 1);
+      }
+    }
+    face = d[exit_axis] > 0 ? kEnterForward[exit_axis]
+                            : kEnterBackward[exit_axis];
+  }
+  return false;
+}
+
+bool ChunkGrid::IsRegionEmpty(const int min[3], const int max[3]) const {
+  ChunkCoord min_chunk = ToChunkCoord(min[0], min[1], min[2]);
+  ChunkCoord max_chunk = ToChunkCoord(max[0] - 1, max[1] - 1, max[2] - 1);
+  for (int cx = min_chunk.x; cx <= max_chunk.x; cx++) {
+    for (int cy = min_chunk.y; cy <= max_chunk.y; cy++) {
+      for (int cz = min_chunk.z; cz <= max_chunk.z; cz++) {
+        const Chunk* chunk = FindChunk({cx, cy, cz});
+        if (chunk == nullptr) {
+          continue;
+        }
+        const int base[3] = {cx * kChunkSize, cy * kChunkSize,
+                             cz * kChunkSize};
+        int local_min[3];
+        int local_max[3];
+        for (int axis = 0; axis < 3; axis++) {
+          local_min[axis] = std::max(min[axis] - base[axis], 0);
+          local_max[axis] = std::min(max[axis] - base[axis], kChunkSize);
+        }
+        if (chunk->octree_.AnySolid(local_min, local_max)) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+RemeshPatch ChunkGrid::RebuildDirty(ThreadPool* pool) {
+  auto start = std::chrono::steady_clock::now();
+
+  RemeshPatch patch;
+  std::vector<Chunk*> dirty;
+  for (auto& [coord, chunk] : chunks_) {
+    if (chunk.dirty_) {
+      // Edits can leave palette entries no voxel uses anymore, dropping them
+      // can lower the bits per index again. Done here, before any worker
+      // reads this chunk through the padded border of a neighbor.
+      if (chunk.edited_) {
+        chunk.voxels_.Compact();
+      }
+      patch.chunks.push_back(coord);
+      dirty.push_back(&chunk);
+    }
+  }
+
+  // Meshing only reads the voxels and writes the mesh of its own chunk, so
+  // chunks can be meshed concurrently.
+  std::vector<float> latencies(dirty.size());
+  auto mesh = [&](size_t i) {
+    auto chunk_start = std::chrono::steady_clock::now();
+    MeshChunk(patch.chunks[i], *dirty[i]);
+    dirty[i]->dirty_ = false;
+    latencies[i] = std::chrono::duration<float, std::milli>(
+                       std::chrono::steady_clock::now() - chunk_start)
+                       .count();
+  };
+  if (pool != nullptr) {
+    pool->ParallelFor(dirty.size(), mesh);
+  } else {
+    for (size_t i = 0; i < dirty.size(); i++) {
+      mesh(i);
+    }
+  }
+
+  for (float latency : latencies) {
+    remesh_latency_.Add(latency);
+  }
+  patch.milliseconds = std::chrono::duration<float, std::milli>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+  return patch;
+}
+
+void ChunkGrid::MarkAllDirty() {
+  for (auto& [coord, chunk] : chunks_) {
+    chunk.dirty_ = true;
+  }
+}
+
+void ChunkGrid::GatherPadded(ChunkCoord coord,
+                             std::vector<VoxelId>& out) const {
+  out.assign(kPaddedVolume, kAir);
+
+  for (int dx = -1; dx <= 1; dx++) {
+    for (int dy = -1; dy <= 1; dy++) {
+      for (int dz = -1; dz <= 1; dz++) {
+        const Chunk* chunk =
+            FindChunk({coord.x + dx, coord.y + dy, coord.z + dz});
+        if (chunk == nullptr) {
+          continue;
+        }
+
+        // Range of the neighbor's local coordinates that fall in the border.
+        int x0 = dx < 0 ? kChunkMask : 0, x1 = dx > 0 ? 0 : kChunkMask;
+        int y0 = dy < 0 ? kChunkMask : 0, y1 = dy > 0 ? 0 : kChunkMask;
+        int z0 = dz < 0 ? kChunkMask : 0, z1 = dz > 0 ? 0 : kChunkMask;
+        // y is the fastest axis of both layouts, so each column is one bulk
+        // copy out of the palette storage.
+        for (int x = x0; x <= x1; x++) {
+          for (int z = z0; z <= z1; z++) {
+            chunk->voxels_.GetRange(
+                Chunk::Index(x, y0, z), y1 - y0 + 1,
+                &out[PaddedIndex(x + dx * kChunkSize, y0 + dy * kChunkSize,
+                                 z + dz * kChunkSize)]);
+          }
+        }
+      }
+    }
+  }
+}
+
+size_t ChunkGrid::FindVisibleFaces(const ColumnOccupancy& occupancy,
+                                   std::vector<uint8_t>& visible) {
+  visible.assign(kChunkVolume, 0);
+  size_t face_count = 0;
+  for (int x = 0; x < kChunkSize; x++) {
+    for (int z = 0; z < kChunkSize; z++) {
+      // Every face of the whole column at once, then only the voxels with at
+      // least one visible face are visited.
+      uint64_t faces[kFaceCount];
+      uint64_t any = 0;
+      for (int face = 0; face < kFaceCount; face++) {
+        faces[face] = occupancy.VisibleFaces(x, z, face);
+        face_count += std::popcount(faces[face]);
+        any |= faces[face];
+      }
+
+      for (; any != 0; any &= any - 1) {
+        int bit = std::countr_zero(any);
+        uint8_t mask = 0;
+        for (int face = 0; face < kFaceCount; face++) {
+          mask |= ((faces[face] >> bit) & 1) << face;
+        }
+        visible[Chunk::Index(x, bit - 1, z)] = mask;
+      }
+    }
+  }
+  return face_count;
+}
+
+void ChunkGrid::MeshPacked(ChunkCoord coord, PackedGeometryBuilder& out) const {
+  out = PackedGeometryBuilder();
+
+  const Chunk* chunk = FindChunk(coord);
+  if (chunk == nullptr) {
+    return;
+  }
+
+  std::vector<VoxelId> padded;
+  GatherPadded(coord, padded);
+  std::vector<uint8_t> visible;
+  out.ReserveFaces(FindVisibleFaces(ColumnOccupancy(padded), visible));
+
+  for (int x = 0; x < kChunkSize; x++) {
+    for (int z = 0; z < kChunkSize; z++) {
+      for (int y = 0; y < kChunkSize; y++) {
+        uint8_t faces = visible[Chunk::Index(x, y, z)];
+        if (faces != 0) {
+          out.PushCube(x, y, z, chunk->Get(x, y, z), faces);
+        }
+      }
+    }
+  }
+}
+
+void ChunkGrid::MeshChunk(ChunkCoord coord, Chunk& chunk) const {
+  std::vector<VoxelId> padded;
+  GatherPadded(coord, padded);
+  MeshChunk(coord, padded, chunk);
+}
+
+// Whether the voxels of the padded border facing the six sides of the chunk
+// are all solid, edges and corners aside.
+static bool IsEnclosed(const std::vector<VoxelId>& padded) {
+  for (int a = 0; a < kChunkSize; a++) {
+    for (int b = 0; b < kChunkSize; b++) {
+      if (padded[ChunkGrid::PaddedIndex(-1, a, b)] == kAir ||
+          padded[ChunkGrid::PaddedIndex(kChunkSize, a, b)] == kAir ||
+          padded[ChunkGrid::PaddedIndex(a, -1, b)] == kAir ||
+          padded[ChunkGrid::PaddedIndex(a, kChunkSize, b)] == kAir ||
+          padded[ChunkGrid::PaddedIndex(a, b, -1)] == kAir ||
+          padded[ChunkGrid::PaddedIndex(a, b, kChunkSize)] == kAir) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void ChunkGrid::MeshChunk(ChunkCoord coord, const std::vector<VoxelId>& padded,
+                          Chunk& chunk) const {
+  chunk.mesh_ = GeometryBuilder();
+  for (int lod = 1; lod < kLodCount; lod++) {
+    chunk.lod_meshes_[lod - 1] = GeometryBuilder();
+  }
+
+  // The octree is kept current with the voxels, an all air chunk has nothing
+  // to mesh at any level.
+  if (chunk.octree_.IsUniform() && chunk.octree_.root_id() == kAir) {
+    return;
+  }
+  // Neither has an all solid chunk buried under the surface, unless every
+  // voxel is drawn.
+  if (chunk.octree_.IsUniform() && mesh_mode_ != MeshMode::kNaive &&
+      IsEnclosed(padded)) {
+    return;
+  }
+
+  switch (mesh_mode_) {
+    case MeshMode::kNaive:
+      MeshNaive(coord, chunk);
+      break;
+    case MeshMode::kCulled:
+      MeshCulled(coord, padded, ColumnOccupancy(padded), chunk);
+      break;
+    case MeshMode::kGreedy:
+      MeshGreedy(coord, padded, ColumnOccupancy(padded), chunk);
+      break;
+    case MeshMode::kHeightfield:
+      MeshHeightfield(coord, padded, ColumnOccupancy(padded), chunk);
+      break;
+  }
+  FinishMesh(chunk.mesh_);
+
+  if (build_lods_) {
+    for (int lod = 1; lod < kLodCount; lod++) {
+      GeometryBuilder& mesh = chunk.lod_meshes_[lod - 1];
+      MeshLod(coord, padded, lod, mesh);
+      FinishMesh(mesh);
+    }
+  }
+}
+
+void ChunkGrid::FinishMesh(GeometryBuilder& mesh) const {
+  if (weld_vertices_) {
+    mesh.WeldVertices();
+  }
+  if (optimize_vertex_cache_) {
+    OptimizeVertexCache(mesh.indices_, mesh.vertices_.size());
+  }
+  mesh.CompactIndices();
+}
+
+int ChunkGrid::SelectLod(ChunkCoord coord,
+                         const Math::Vec3F& camera_position) const {
+  // Voxel centers sit on integer coordinates, the chunk center half a voxel
+  // below the middle of its range.
+  float half = kChunkSize * 0.5f - 0.5f;
+  float dx = (coord.x * kChunkSize + half) * voxel_scale_ - camera_position.X;
+  float dy = (coord.y * kChunkSize + half) * voxel_scale_ - camera_position.Y;
+  float dz = (coord.z * kChunkSize + half) * voxel_scale_ - camera_position.Z;
+  float distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+
+  int lod = 0;
+  while (lod < kLodCount - 1 && distance >= lod_distances_[lod]) {
+    lod++;
+  }
+  return lod;
+}
+
+void ChunkGrid::MeshNaive(ChunkCoord coord, Chunk& chunk) const {
+  size_t solid = kChunkVolume - chunk.voxels_.Count(kAir);
+  chunk.mesh_.ReserveFaces(solid * kFaceCount);
+
+  int base_x = coord.x * kChunkSize;
+  int base_y = coord.y * kChunkSize;
+  int base_z = coord.z * kChunkSize;
+  chunk.octree_.ForEachSolidLeaf(
+      [&](int x0, int y0, int z0, int size, VoxelId id) {
+        for (int x = x0; x < x0 + size; x++) {
+          for (int z = z0; z < z0 + size; z++) {
+            for (int y = y0; y < y0 + size; y++) {
+              Vec3 position = Vec3(base_x + x, base_y + y, base_z + z);
+              chunk.mesh_.PushCube(voxel_scale_, position, palette_[id]);
+            }
+          }
+        }
+      });
+}
+
+// Ambient occlusion: each corner of a face is darkened by the solid voxels
+// among the three that touch it in the layer in front of the face. The
+// occlusion of a corner goes from 0 (open) to 3 (both sides solid).
+constexpr float kOcclusionBrightness[4] = {1.0f, 0.8f, 0.65f, 0.5f};
+
+// Occlusion of the four corners of a face, 2 bits each in kCubeCorners order,
+// indexed by ColumnOccupancy::FrontLayer().
+static constexpr auto kFaceOcclusion = [] {
+  std::array<std::array<uint8_t, 512>, kFaceCount> table{};
+  for (int face = 0; face < kFaceCount; face++) {
+    const int* n = kFaceNormals[face];
+    int d = n[0] != 0 ? 0 : (n[1] != 0 ? 1 : 2);
+    int u = (d + 1) % 3;
+    int v = (d + 2) % 3;
+    for (int layer = 0; layer < 512; layer++) {
+      auto solid = [layer](int du, int dv) {
+        return (layer >> ((dv + 1) * 3 + du + 1)) & 1;
+      };
+      uint8_t occlusion = 0;
+      for (int corner = 0; corner < 4; corner++) {
+        const float* c = kCubeCorners[face * 4 + corner];
+        int su = c[u] < 0 ? -1 : 1;
+        int sv = c[v] < 0 ? -1 : 1;
+        int side1 = solid(su, 0);
+        int side2 = solid(0, sv);
+        int level = side1 && side2 ? 3 : side1 + side2 + solid(su, sv);
+        occlusion |= level << (corner * 2);
+      }
+      table[face][layer] = occlusion;
+    }
+  }
+  return table;
+}();
+
+// Darkens the four vertices of a quad pushed at `vertex` and `index`, and
+// splits it along the least occluded diagonal so the shading stays
+// symmetric instead of following the triangle edges.
+static void ShadeQuad(GeometryBuilder& mesh, size_t vertex, size_t index,
+                      uint8_t occlusion) {
+  int level[4];
+  for (int corner = 0; corner < 4; corner++) {
+    level[corner] = (occlusion >> (corner * 2)) & 3;
+    Vertex& v = mesh.vertices_[vertex + corner];
+    v.color = v.color * kOcclusionBrightness[level[corner]];
+  }
+
+  if (level[0] + level[2] < level[1] + level[3]) {
+    constexpr uint32_t kFlippedIndices[6] = {0, 1, 2, 0, 2, 3};
+    for (int i = 0; i < 6; i++) {
+      mesh.indices_[index + i] = kFlippedIndices[i] + vertex;
+    }
+  }
+}
+
+void ChunkGrid::MeshCulled(ChunkCoord coord,
+                           const std::vector<VoxelId>& padded,
+                           const ColumnOccupancy& occupancy,
+                           Chunk& chunk) const {
+  // First pass: the visible faces of every voxel, so the mesh is sized once.
+  std::vector<uint8_t> visible;
+  chunk.mesh_.ReserveFaces(FindVisibleFaces(occupancy, visible));
+
+  // Second pass: gather the visible cubes and emit them in one batch.
+  std::vector<Math::Vec3F> positions;
+  std::vector<Vec3> colors;
+  std::vector<uint8_t> masks;
+  // Corner occlusion of every emitted face, in PushCubes order.
+  std::vector<uint8_t> occlusions;
+  int base_x = coord.x * kChunkSize;
+  int base_y = coord.y * kChunkSize;
+  int base_z = coord.z * kChunkSize;
+  for (int x = 0; x < kChunkSize; x++) {
+    for (int z = 0; z < kChunkSize; z++) {
+      for (int y = 0; y < kChunkSize; y++) {
+        uint8_t faces = visible[Chunk::Index(x, y, z)];
+        if (faces == 0) {
+          continue;
+        }
+
+        VoxelId id = padded[PaddedIndex(x, y, z)];
+        positions.emplace_back(base_x + x, base_y + y, base_z + z);
+        colors.push_back(palette_[id]);
+        masks.push_back(faces);
+
+        if (ambient_occlusion_) {
+          for (int face = 0; face < kFaceCount; face++) {
+            if ((faces & (1 << face)) != 0) {
+              occlusions.push_back(kFaceOcclusion[face][occupancy.FrontLayer(
+                  x, y, z, face)]);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  size_t first_vertex = chunk.mesh_.vertices_.size();
+  size_t first_index = chunk.mesh_.indices_.size();
+  chunk.mesh_.PushCubes(positions, std::span<const float>(&voxel_scale_, 1),
+                        colors, masks);
+  for (size_t i = 0; i < occlusions.size(); i++) {
+    if (occlusions[i] != 0) {
+      ShadeQuad(chunk.mesh_, first_vertex + i * 4, first_index + i * 6,
+                occlusions[i]);
+    }
+  }
+}
+
+// Faces merge when they have the same color: up faces take the palette
+// color of their voxel, all the other faces share the dirt color. With
+// ambient occlusion the corner occlusion sits above the color, in bits 9 to
+// 16, so only faces shaded the same way merge.
+constexpr uint32_t kNoFace = 0;
+constexpr uint32_t kSideKey = 0x100;
+constexpr uint32_t kColorKeyMask = 0x1FF;
+constexpr int kOcclusionKeyShift = 9;
+
+struct GreedyQuad {
+  CubeFace face;
+  uint32_t key;
+  float min[3];
+  float max[3];
+};
+
+// Greedy meshing of a grid of size^3 cells, each cell_size voxels wide, the
+// first one centered on voxel `base`. fill_slice(face, slice, mask) writes
+// the merge key of the visible faces of a slice to `mask`, cleared to kNoFace
+// and indexed j * size + i along v and u, and returns false when the slice
+// has none. The faces of each slice are grown along u then along v while the
+// whole row matches.
+template <typename FillSlice>
+static void MergeFaces(const int base[3], int size, int cell_size,
+                       FillSlice fill_slice, std::vector<GreedyQuad>& quads) {
+  std::vector<uint32_t> mask(size * size);
+
+  for (int face = 0; face < kFaceCount; face++) {
+    const int* n = kFaceNormals[face];
+    int d = n[0] != 0 ? 0 : (n[1] != 0 ? 1 : 2);
+    int u = (d + 1) % 3;
+    int v = (d + 2) % 3;
+
+    for (int slice = 0; slice < size; slice++) {
+      std::fill(mask.begin(), mask.end(), kNoFace);
+      if (!fill_slice(face, slice, mask)) {
+        continue;
+      }
+
+      for (int j = 0; j < size; j++) {
+        for (int i = 0; i < size;) {
+          uint32_t key = mask[j * size + i];
+          if (key == kNoFace) {
+            i++;
+            continue;
+          }
+
+          int w = 1;
+          while (i + w < size && mask[j * size + i + w] == key) {
+            w++;
+          }
+
+          int h = 1;
+          for (; j + h < size; h++) {
+            bool row_matches = true;
+            for (int k = 0; k < w; k++) {
+              if (mask[(j + h) * size + i + k] != key) {
+                row_matches = false;
+                break;
+              }
+            }
+            if (!row_matches) {
+              break;
+            }
+          }
+
+          GreedyQuad& quad = quads.emplace_back();
+          quad.face = static_cast<CubeFace>(face);
+          quad.key = key;
+          quad.min[d] = base[d] + slice * cell_size - 0.5f;
+          quad.max[d] = quad.min[d] + cell_size;
+          quad.min[u] = base[u] + i * cell_size - 0.5f;
+          quad.max[u] = quad.min[u] + w * cell_size;
+          quad.min[v] = base[v] + j * cell_size - 0.5f;
+          quad.max[v] = quad.min[v] + h * cell_size;
+
+          for (int l = 0; l < h; l++) {
+            for (int k = 0; k < w; k++) {
+              mask[(j + l) * size + i + k] = kNoFace;
+            }
+          }
+          i += w;
+        }
+      }
+    }
+  }
+}
+
+// FillSlice for MergeFaces() from face_key(face, cell), the merge key of a
+// single cell face.
+template <typename FaceKey>
+static auto CellKeys(int size, FaceKey face_key) {
+  return [size, face_key](int face, int slice, std::vector<uint32_t>& mask) {
+    const int* n = kFaceNormals[face];
+    int d = n[0] != 0 ? 0 : (n[1] != 0 ? 1 : 2);
+    int u = (d + 1) % 3;
+    int v = (d + 2) % 3;
+
+    bool any = false;
+    int cell[3];
+    cell[d] = slice;
+    for (int j = 0; j < size; j++) {
+      cell[v] = j;
+      for (int i = 0; i < size; i++) {
+        cell[u] = i;
+        uint32_t key = face_key(face, cell);
+        mask[j * size + i] = key;
+        any |= key != kNoFace;
+      }
+    }
+    return any;
+  };
+}
+
+static void PushGreedyQuads(const std::vector<GreedyQuad>& quads,
+                            const std::vector<Vec3>& palette, float scale,
+                            GeometryBuilder& mesh) {
+  mesh.ReserveFaces(quads.size());
+  for (const GreedyQuad& quad : quads) {
+    uint32_t color_key = quad.key & kColorKeyMask;
+    Vec3 color = color_key == kSideKey ? kDirtColor : palette[color_key];
+    size_t vertex = mesh.vertices_.size();
+    size_t index = mesh.indices_.size();
+    mesh.PushBoxFace(quad.face, scale, quad.min, quad.max, color);
+
+    uint8_t occlusion = quad.key >> kOcclusionKeyShift;
+    if (occlusion != 0) {
+      ShadeQuad(mesh, vertex, index, occlusion);
+    }
+  }
+}
+
+void ChunkGrid::MeshGreedy(ChunkCoord coord,
+                           const std::vector<VoxelId>& padded,
+                           const ColumnOccupancy& occupancy,
+                           Chunk& chunk) const {
+  // Visible faces of every column, one mask per face, and per face the
+  // heights that have any.
+  std::vector<uint64_t> visible(kFaceCount * kChunkSize * kChunkSize);
+  uint64_t heights[kFaceCount] = {};
+  for (int face = 0; face < kFaceCount; face++) {
+    uint64_t* columns = &visible[face * kChunkSize * kChunkSize];
+    for (int x = 0; x < kChunkSize; x++) {
+      for (int z = 0; z < kChunkSize; z++) {
+        columns[x * kChunkSize + z] = occupancy.VisibleFaces(x, z, face);
+        heights[face] |= columns[x * kChunkSize + z];
+      }
+    }
+  }
+
+  auto face_key = [&](int face, int x, int y, int z) -> uint32_t {
+    uint32_t key = face == kFaceUp ? padded[PaddedIndex(x, y, z)] : kSideKey;
+    if (ambient_occlusion_) {
+      key |= static_cast<uint32_t>(
+                 kFaceOcclusion[face][occupancy.FrontLayer(x, y, z, face)])
+             << kOcclusionKeyShift;
+    }
+    return key;
+  };
+
+  // Only the visible faces are visited: x and z slices walk the set bits of
+  // their columns, y slices test one bit per column and are skipped whole
+  // when no column has a face at their height.
+  auto fill_slice = [&](int face, int slice, std::vector<uint32_t>& mask) {
+    const uint64_t* columns = &visible[face * kChunkSize * kChunkSize];
+    const int* n = kFaceNormals[face];
+    bool any = false;
+    if (n[1] != 0) {
+      // u is z and v is x.
+      if (((heights[face] >> (slice + 1)) & 1) == 0) {
+        return false;
+      }
+      for (int x = 0; x < kChunkSize; x++) {
+        for (int z = 0; z < kChunkSize; z++) {
+          if ((columns[x * kChunkSize + z] >> (slice + 1)) & 1) {
+            mask[x * kChunkSize + z] = face_key(face, x, slice, z);
+            any = true;
+          }
+        }
+      }
+    } else {
+      // u is y and v is z for x slices, u is x and v is y for z slices.
+      for (int k = 0; k < kChunkSize; k++) {
+        int x = n[0] != 0 ? slice : k;
+        int z = n[0] != 0 ? k : slice;
+        for (uint64_t bits = columns[x * kChunkSize + z] >> 1; bits != 0;
+             bits &= bits - 1) {
+          int y = std::countr_zero(bits);
+          int index = n[0] != 0 ? z * kChunkSize + y : y * kChunkSize + x;
+          mask[index] = face_key(face, x, y, z);
+          any = true;
+        }
+      }
+    }
+    return any;
+  };
+
+  // Quads are collected first so the mesh is sized once.
+  const int base[3] = {coord.x * kChunkSize, coord.y * kChunkSize,
+                       coord.z * kChunkSize};
+  std::vector<GreedyQuad> quads;
+  MergeFaces(base, kChunkSize, 1, fill_slice, quads);
+  PushGreedyQuads(quads, palette_, voxel_scale_, chunk.mesh_);
+}
+
+void ChunkGrid::MeshHeightfield(ChunkCoord coord,
+                                const std::vector<VoxelId>& padded,
+                                const ColumnOccupancy& occupancy,
+                                Chunk& chunk) const {
+  // Every column is taken as solid from its highest voxel down, so only the
+  // occupancy bits are scanned and the voxels themselves are only read for
+  // the material of the tops. Fresh terrain skips the voxels altogether, see
+  // the overload taking column heights.
+  const int base[3] = {coord.x * kChunkSize, coord.y * kChunkSize,
+                       coord.z * kChunkSize};
+  chunk.mesh_.ReserveFaces(kChunkSize * kChunkSize);
+  for (int x = 0; x < kChunkSize; x++) {
+    for (int z = 0; z < kChunkSize; z++) {
+      int top = occupancy.TopSolid(x, z);
+      if (top < 0) {
+        continue;
+      }
+
+      float min[3] = {base[0] + x - 0.5f, base[1] + top - 0.5f,
+                      base[2] + z - 0.5f};
+      float max[3] = {min[0] + 1, min[1] + 1, min[2] + 1};
+      // Columns that go on in the chunk above get their top face there.
+      if (!occupancy.IsSolid(x, top + 1, z)) {
+        VoxelId id = padded[PaddedIndex(x, top, z)];
+        chunk.mesh_.PushBoxFace(kFaceUp, voxel_scale_, min, max,
+                                palette_[id]);
+      }
+
+      // Bottom of the solid run under the top, the chunk bottom when it goes
+      // on in the chunk below: the highest air bit under the top plus one.
+      uint64_t air_below =
+          ~occupancy.Column(x, z) & ((uint64_t{1} << (top + 1)) - 1);
+      int bottom = air_below == 0 ? 0 : 63 - std::countl_zero(air_below);
+
+      // One skirt per lower neighbor, from just above its top up to ours.
+      for (CubeFace face : {kFaceFront, kFaceBack, kFaceRight, kFaceLeft}) {
+        const int* n = kFaceNormals[face];
+        int from = std::max(occupancy.TopSolid(x + n[0], z + n[2]) + 1, bottom);
+        if (from > top) {
+          continue;
+        }
+        min[1] = base[1] + from - 0.5f;
+        chunk.mesh_.PushBoxFace(face, voxel_scale_, min, max, kDirtColor);
+      }
+    }
+  }
+}
+
+void ChunkGrid::MeshHeightfield(ChunkCoord coord, const int* tops,
+                                const VoxelId* materials, int min_y,
+                                Chunk& chunk) const {
+  chunk.mesh_ = GeometryBuilder();
+  for (int lod = 1; lod < kLodCount; lod++) {
+    chunk.lod_meshes_[lod - 1] = GeometryBuilder();
+  }
+
+  const int base[3] = {coord.x * kChunkSize, coord.y * kChunkSize,
+                       coord.z * kChunkSize};
+  // Same as ColumnOccupancy::TopSolid() on the voxels of a column solid from
+  // min_y to its top: its highest voxel within the chunk, -1 when none.
+  auto top_solid = [&](int x, int z) {
+    int top = std::min(tops[(x + 1) * kPaddedSize + (z + 1)],
+                       base[1] + kChunkSize) - 1;
+    return top < std::max(min_y, base[1]) ? -1 : top - base[1];
+  };
+  int bottom = std::max(min_y - base[1], 0);
+
+  chunk.mesh_.ReserveFaces(kChunkSize * kChunkSize);
+  for (int x = 0; x < kChunkSize; x++) {
+    for (int z = 0; z < kChunkSize; z++) {
+      int top = top_solid(x, z);
+      if (top < 0) {
+        continue;
+      }
+
+      float min[3] = {base[0] + x - 0.5f, base[1] + top - 0.5f,
+                      base[2] + z - 0.5f};
+      float max[3] = {min[0] + 1, min[1] + 1, min[2] + 1};
+      if (tops[(x + 1) * kPaddedSize + (z + 1)] <= base[1] + kChunkSize) {
+        chunk.mesh_.PushBoxFace(kFaceUp, voxel_scale_, min, max,
+                                palette_[materials[x * kChunkSize + z]]);
+      }
+
+      for (CubeFace face : {kFaceFront, kFaceBack, kFaceRight, kFaceLeft}) {
+        const int* n = kFaceNormals[face];
+        int from = std::max(top_solid(x + n[0], z + n[2]) + 1, bottom);
+        if (from > top) {
+          continue;
+        }
+        min[1] = base[1] + from - 0.5f;
+        chunk.mesh_.PushBoxFace(face, voxel_scale_, min, max, kDirtColor);
+      }
+    }
+  }
+  FinishMesh(chunk.mesh_);
+}
+
+void ChunkGrid::MeshLod(ChunkCoord coord, const std::vector<VoxelId>& padded,
+                        int lod, GeometryBuilder& out) const {
+  const int factor = 1 << lod;
+  const int size = kChunkSize >> lod;
+  auto cell_index = [size](int x, int y, int z) {
+    return (x * size + z) * size + y;
+  };
+
+  // A cell is solid as soon as one of its voxels is, so every level contains
+  // the finer ones. It takes the material of its top most voxel, the first
+  // one in x then z order among those at the same height.
+  std::vector<VoxelId> cells(size * size * size, kAir);
+  std::vector<int> cell_tops(size * size * size, -1);
+  for (int x = 0; x < kChunkSize; x++) {
+    for (int z = 0; z < kChunkSize; z++) {
+      for (int y = 0; y < kChunkSize; y++) {
+        VoxelId id = padded[PaddedIndex(x, y, z)];
+        int cell = cell_index(x >> lod, y >> lod, z >> lod);
+        if (id != kAir && y > cell_tops[cell]) {
+          cells[cell] = id;
+          cell_tops[cell] = y;
+        }
+      }
+    }
+  }
+
+  // Inside the chunk a face is hidden by a solid neighbor cell. On the chunk
+  // border it is kept as a skirt unless every full resolution voxel behind
+  // it is solid: neighbors drawn at a finer LOD are then never higher than
+  // this chunk and the skirt closes the crack between the two.
+  auto hidden = [&](const int cell[3], int face) {
+    const int* n = kFaceNormals[face];
+    int neighbor[3] = {cell[0] + n[0], cell[1] + n[1], cell[2] + n[2]};
+    if (neighbor[0] >= 0 && neighbor[0] < size && neighbor[1] >= 0 &&
+        neighbor[1] < size && neighbor[2] >= 0 && neighbor[2] < size) {
+      return cells[cell_index(neighbor[0], neighbor[1], neighbor[2])] != kAir;
+    }
+
+    int from[3];
+    int to[3];
+    for (int a = 0; a < 3; a++) {
+      if (n[a] != 0) {
+        from[a] = to[a] = n[a] > 0 ? kChunkSize : -1;
+      } else {
+        from[a] = cell[a] * factor;
+        to[a] = from[a] + factor - 1;
+      }
+    }
+    for (int x = from[0]; x <= to[0]; x++) {
+      for (int y = from[1]; y <= to[1]; y++) {
+        for (int z = from[2]; z <= to[2]; z++) {
+          if (padded[PaddedIndex(x, y, z)] == kAir) {
+            return false;
+          }
+        }
+      }
+    }
+    return true;
+  };
+
+  auto face_key = [&](int face, const int cell[3]) -> uint32_t {
+    VoxelId id = cells[cell_index(cell[0], cell[1], cell[2])];
+    if (id == kAir || hidden(cell, face)) {
+      return kNoFace;
+    }
+    return face == kFaceUp ? id : kSideKey;
+  };
+
+  const int base[3] = {coord.x * kChunkSize, coord.y * kChunkSize,
+                       coord.z * kChunkSize};
+  std::vector<GreedyQuad> quads;
+  MergeFaces(base, size, factor, CellKeys(size, face_key), quads);
+  PushGreedyQuads(quads, palette_, voxel_scale_, out);
+}
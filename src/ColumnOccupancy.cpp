@@ -0,0 +1,68 @@
+#include "ColumnOccupancy.h"
+
+#include <bit>
+#include <cstring>
+
+// One bit per byte of `bytes`, set when the byte is not zero, gathered in
+// the low 8 bits in memory order (little endian).
+static uint64_t NonZeroBytes(uint64_t bytes) {
+  constexpr uint64_t kLow7 = 0x7F7F7F7F7F7F7F7Full;
+  uint64_t high = (((bytes & kLow7) + kLow7) | bytes) & ~kLow7;
+  // Moves the flag of byte k from bit 8k + 7 to bit 56 + k.
+  return (high >> 7) * 0x0102040810204080ull >> 56;
+}
+
+ColumnOccupancy::ColumnOccupancy(const std::vector<VoxelId>& padded) {
+  static_assert(sizeof(VoxelId) == 1 && kPaddedSize == 34);
+  // Padded columns are contiguous, y being the fastest axis: 8 heights per
+  // word plus the top two.
+  for (size_t column = 0; column < columns_.size(); column++) {
+    const VoxelId* voxels = &padded[column * kPaddedSize];
+    uint64_t bits = 0;
+    for (int y = 0; y < 32; y += 8) {
+      uint64_t bytes;
+      std::memcpy(&bytes, voxels + y, sizeof(bytes));
+      bits |= NonZeroBytes(bytes) << y;
+    }
+    bits |= static_cast<uint64_t>(voxels[32] != kAir) << 32;
+    bits |= static_cast<uint64_t>(voxels[33] != kAir) << 33;
+    columns_[column] = bits;
+  }
+}
+
+int ColumnOccupancy::TopSolid(int x, int z) const {
+  uint64_t solid = Column(x, z) & kInside;
+  if (solid == 0) {
+    return -1;
+  }
+  return 63 - std::countl_zero(solid) - 1;
+}
+
+int ColumnOccupancy::FrontLayer(int x, int y, int z, int face) const {
+  const int* n = kFaceNormals[face];
+  int layer = 0;
+  if (n[0] != 0) {
+    // u is y and v is z: three bits of one column per row of the layer.
+    for (int dv = -1; dv <= 1; dv++) {
+      layer |= ((Column(x + n[0], z + dv) >> y) & 7) << ((dv + 1) * 3);
+    }
+  } else if (n[2] != 0) {
+    // u is x and v is y: three bits of one column per column of the layer,
+    // spread three bits apart.
+    for (int du = -1; du <= 1; du++) {
+      uint64_t bits = Column(x + du, z + n[2]) >> y;
+      layer |= static_cast<int>((bits & 1) | (bits & 2) << 2 | (bits & 4) << 4)
+               << (du + 1);
+    }
+  } else {
+    // u is z and v is x: one bit of each of the nine columns.
+    int bit = y + n[1] + 1;
+    for (int dv = -1; dv <= 1; dv++) {
+      for (int du = -1; du <= 1; du++) {
+        layer |= static_cast<int>((Column(x + dv, z + du) >> bit) & 1)
+                 << ((dv + 1) * 3 + du + 1);
+      }
+    }
+  }
+  return layer;
+}
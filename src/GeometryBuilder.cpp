@@ -1,5 +1,95 @@
 #include "GeometryBuilder.h"
 
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+void GeometryBuilder::ReserveFaces(size_t faces) {
+  vertices_.reserve(vertices_.size() + faces * 4);
+  indices_.reserve(indices_.size() + faces * 6);
+}
+
+static uint32_t HashVertex(const Vertex& vertex) {
+  // FNV-1a over the raw bytes, welding only merges bit-identical vertices.
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&vertex);
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < sizeof(Vertex); i++) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+WeldStats GeometryBuilder::WeldVertices() {
+  WeldStats stats = {vertices_.size(), vertices_.size()};
+  if (vertices_.empty()) {
+    return stats;
+  }
+
+  // Open addressing with linear probing, kept at most half full. Slots hold
+  // the index of the welded vertex, kEmpty marks a free slot.
+  constexpr uint32_t kEmpty = UINT32_MAX;
+  size_t capacity = std::bit_ceil(vertices_.size() * 2);
+  size_t mask = capacity - 1;
+  std::vector<uint32_t> slots(capacity, kEmpty);
+
+  std::vector<uint32_t> remap(vertices_.size());
+  uint32_t welded_count = 0;
+  for (size_t i = 0; i < vertices_.size(); i++) {
+    const Vertex& vertex = vertices_[i];
+    size_t slot = HashVertex(vertex) & mask;
+    while (slots[slot] != kEmpty &&
+           memcmp(&vertices_[slots[slot]], &vertex, sizeof(Vertex)) != 0) {
+      slot = (slot + 1) & mask;
+    }
+
+    if (slots[slot] == kEmpty) {
+      // Welded vertices are compacted in place, welded_count <= i so the
+      // vertices still to be read are never overwritten.
+      vertices_[welded_count] = vertex;
+      slots[slot] = welded_count++;
+    }
+    remap[i] = slots[slot];
+  }
+
+  vertices_.resize(welded_count);
+  for (uint32_t& index : indices_) {
+    index = remap[index];
+  }
+
+  stats.vertices_after = welded_count;
+  return stats;
+}
+
+IndexFormat GeometryBuilder::CompactIndices() {
+  if (index_format_ == IndexFormat::kUInt16 || vertices_.size() > 0x10000) {
+    return index_format_;
+  }
+
+  indices16_.assign(indices_.begin(), indices_.end());
+  indices_.clear();
+  indices_.shrink_to_fit();
+  index_format_ = IndexFormat::kUInt16;
+  return index_format_;
+}
+
+const void* GeometryBuilder::index_data() const {
+  return index_format_ == IndexFormat::kUInt16
+             ? static_cast<const void*>(indices16_.data())
+             : static_cast<const void*>(indices_.data());
+}
+
+size_t GeometryBuilder::index_count() const {
+  return index_format_ == IndexFormat::kUInt16 ? indices16_.size()
+                                               : indices_.size();
+}
+
+size_t GeometryBuilder::index_size() const {
+  return index_format_ == IndexFormat::kUInt16 ? sizeof(uint16_t)
+                                               : sizeof(uint32_t);
+}
+
 void GeometryBuilder::PushQuad(float scale, Vec3 pos, Vec3 color) {
   uint32_t offset = vertices_.size();
 
@@ -20,46 +110,127 @@ void GeometryBuilder::PushQuad(float scale, Vec3 pos, Vec3 color) {
   indices_.push_back(3 + offset);
 }
 
-void GeometryBuilder::PushCube(float scale, Vec3 pos, Vec3 color) {
-  uint32_t offset = vertices_.size();
+void GeometryBuilder::PushCube(float scale, Vec3 pos, Vec3 color,
+                               uint8_t faces) {
+  // Grow once per cube and write in place, with ReserveFaces() beforehand
+  // this never touches the heap.
+  size_t face_count = std::popcount(faces);
+  size_t vertex_offset = vertices_.size();
+  size_t index_offset = indices_.size();
+  vertices_.resize(vertex_offset + face_count * 4);
+  indices_.resize(index_offset + face_count * 6);
+  Vertex* out_vertex = vertices_.data() + vertex_offset;
+  uint32_t* out_index = indices_.data() + index_offset;
+
+  for (int face = 0; face < kFaceCount; face++) {
+    if ((faces & (1 << face)) == 0) {
+      continue;
+    }
 
-  const std::vector<Vec3> vertices = {
-      Vec3(0.5f, 0.5f, 0.5f),    Vec3(0.5f, -0.5f,
-                                      0.5f),  // front
-      Vec3(-0.5f, -0.5f, 0.5f),  Vec3(-0.5f, 0.5f, 0.5f),
+    uint32_t offset = out_vertex - vertices_.data();
+    Vec3 face_color = face == kFaceUp ? color : kDirtColor;
+    for (int i = face * 4; i < face * 4 + 4; i++) {
+      const float* c = kCubeCorners[i];
+      *out_vertex++ = {(Vec3(c[0], c[1], c[2]) + pos) * scale, Vec2(),
+                       face_color};
+    }
 
-      Vec3(0.5f, 0.5f, -0.5f),   Vec3(0.5f, 0.5f,
-                                      0.5f),  // up
-      Vec3(-0.5f, 0.5f, 0.5f),   Vec3(-0.5f, 0.5f, -0.5f),
+    for (int i = 0; i < 6; ++i) {
+      *out_index++ = kFaceIndices[i] + offset;
+    }
+  }
+}
 
-      Vec3(0.5f, 0.5f, -0.5f),   Vec3(0.5f, -0.5f,
-                                      -0.5f),  // back
-      Vec3(-0.5f, -0.5f, -0.5f), Vec3(-0.5f, 0.5f, -0.5f),
+void GeometryBuilder::PushCubes(std::span<const Math::Vec3F> positions,
+                                std::span<const float> scales,
+                                std::span<const Vec3> colors,
+                                std::span<const uint8_t> faces) {
+  constexpr int kLanes = 4;
+  constexpr int kCornerCount = kFaceCount * 4;
 
-      Vec3(0.5f, -0.5f, -0.5f),  Vec3(0.5f, -0.5f,
-                                      0.5f),  // down
-      Vec3(-0.5f, -0.5f, 0.5f),  Vec3(-0.5f, -0.5f, -0.5f),
+  size_t count = positions.size();
+  size_t face_count = 0;
+  for (size_t i = 0; i < count; i++) {
+    face_count += faces.empty() ? kFaceCount : std::popcount(faces[i]);
+  }
 
-      Vec3(0.5f, 0.5f, -0.5f),   Vec3(0.5f, -0.5f,
-                                      -0.5f),  // right
-      Vec3(0.5f, -0.5f, 0.5f),   Vec3(0.5f, 0.5f, 0.5f),
+  size_t vertex_offset = vertices_.size();
+  size_t index_offset = indices_.size();
+  vertices_.resize(vertex_offset + face_count * 4);
+  indices_.resize(index_offset + face_count * 6);
+  Vertex* out_vertex = vertices_.data() + vertex_offset;
+  uint32_t* out_index = indices_.data() + index_offset;
 
-      Vec3(-0.5f, 0.5f, 0.5f),   Vec3(-0.5f, -0.5f,
-                                      0.5f),  // left
-      Vec3(-0.5f, -0.5f, -0.5f), Vec3(-0.5f, 0.5f, -0.5f)};
+  static const auto corners = [] {
+    std::array<Math::FourVec3F, kCornerCount> result;
+    for (int c = 0; c < kCornerCount; c++) {
+      const float* corner = kCubeCorners[c];
+      result[c] = Math::FourVec3F(
+          Math::Vec3F(corner[0], corner[1], corner[2]));
+    }
+    return result;
+  }();
 
-  const std::vector<uint32_t> indices = {
-      0,  1,  3,  1,  2,  3,  4,  5,  7,  5,  6,  7,  8,  9,  11, 9,  10, 11,
-      12, 13, 15, 13, 14, 15, 16, 17, 19, 17, 18, 19, 20, 21, 23, 21, 22, 23,
-  };
+  for (size_t first = 0; first < count; first += kLanes) {
+    size_t lanes = std::min<size_t>(kLanes, count - first);
+
+    // Unused lanes stay at the origin with a zero scale and are not written.
+    std::array<Math::Vec3F, kLanes> lane_positions{};
+    float lane_scales[kLanes] = {};
+    for (size_t k = 0; k < lanes; k++) {
+      lane_positions[k] = positions[first + k];
+      lane_scales[k] = scales.size() == 1 ? scales[0] : scales[first + k];
+    }
 
-  for (int i = 0; i < vertices.size(); i++) {
-    vertices_.push_back({(vertices[i] + pos) * scale, Vec2(),
-                         i >= 4 && i < 8 ? color : Vec3(0.34, 0.22, 0.24)});
+    // Compound operators on purpose: the NOALIAS binary operators map to
+    // __attribute__((const)) on GCC/Clang, which lets the compiler reuse a
+    // previous iteration's result for the same stack addresses.
+    const Math::FourVec3F centers(lane_positions);
+    Math::FourVec3F lane_corners[kCornerCount];
+    for (int c = 0; c < kCornerCount; c++) {
+      lane_corners[c] = centers;
+      lane_corners[c] += corners[c];
+      lane_corners[c] *= lane_scales;
+    }
+
+    for (size_t k = 0; k < lanes; k++) {
+      uint8_t mask = faces.empty() ? kAllFaces : faces[first + k];
+      Vec3 color = colors[first + k];
+      for (int face = 0; face < kFaceCount; face++) {
+        if ((mask & (1 << face)) == 0) {
+          continue;
+        }
+
+        uint32_t offset = out_vertex - vertices_.data();
+        Vec3 face_color = face == kFaceUp ? color : kDirtColor;
+        for (int c = face * 4; c < face * 4 + 4; c++) {
+          const Math::FourVec3F& corner = lane_corners[c];
+          *out_vertex++ = {Vec3(corner.X()[k], corner.Y()[k], corner.Z()[k]),
+                           Vec2(), face_color};
+        }
+
+        for (int i = 0; i < 6; ++i) {
+          *out_index++ = kFaceIndices[i] + offset;
+        }
+      }
+    }
   }
+}
 
-  for (int i = 0; i < indices.size(); ++i) {
-    indices_.push_back(indices[i] + offset);
+void GeometryBuilder::PushBoxFace(CubeFace face, float scale,
+                                  const float min[3], const float max[3],
+                                  Vec3 color) {
+  uint32_t offset = vertices_.size();
+
+  for (int i = face * 4; i < face * 4 + 4; i++) {
+    const float* c = kCubeCorners[i];
+    Vec3 corner = Vec3(c[0] < 0 ? min[0] : max[0], c[1] < 0 ? min[1] : max[1],
+                       c[2] < 0 ? min[2] : max[2]);
+    vertices_.push_back({corner * scale, Vec2(), color});
+  }
+
+  for (int i = 0; i < 6; ++i) {
+    indices_.push_back(kFaceIndices[i] + offset);
   }
 }
 
@@ -93,28 +264,19 @@ Perlin::Perlin() {
 
 Perlin::Perlin(std::vector<int> hash) { hash_ = hash; }
 
-int Perlin::noise(int x, int y) {
-  int tmp = hash_[(y) % 256];
-  return hash_[(tmp + x) % 256];
-}
-float Perlin::lin_inter(float x, float y, float s) { return x + s * (y - x); }
-float Perlin::smooth_inter(float x, float y, float s) {
-  return lin_inter(x, y, s * s * (3 - 2 * s));
-}
-float Perlin::noise2d(float x, float y) {
-  int x_int = x;
-  int y_int = y;
-  float x_frac = x - x_int;
-  float y_frac = y - y_int;
-  int s = noise(x_int, y_int);
-  int t = noise(x_int + 1, y_int);
-  int u = noise(x_int, y_int + 1);
-  int v = noise(x_int + 1, y_int + 1);
-  float low = smooth_inter(s, t, x_frac);
-  float high = smooth_inter(u, v, x_frac);
-  return smooth_inter(low, high, y_frac);
-}
-float Perlin::perlin2d(float x, float y, float freq, int depth) {
+Perlin::Perlin(uint64_t seed) {
+  for (int i = 0; i < 256; ++i) {
+    hash_.push_back(i);
+  }
+  // Fisher-Yates by hand, std::shuffle differs between standard libraries
+  // while mt19937_64 does not.
+  std::mt19937_64 random(seed);
+  for (int i = 255; i > 0; --i) {
+    std::swap(hash_[i], hash_[random() % (i + 1)]);
+  }
+}
+
+float Perlin::perlin2d(float x, float y, float freq, int depth) const {
   float xa = x * freq;
   float ya = y * freq;
   float amp = 1.0;
@@ -130,3 +292,124 @@ float Perlin::perlin2d(float x, float y, float freq, int depth) {
   }
   return fin / div;
 }
+
+NoiseBounds Perlin::noise2d_bounds(float x_min, float y_min, float x_max,
+                                   float y_max) const {
+  int x0 = static_cast<int>(std::floor(x_min));
+  int y0 = static_cast<int>(std::floor(y_min));
+  int x1 = static_cast<int>(std::floor(x_max)) + 1;
+  int y1 = static_cast<int>(std::floor(y_max)) + 1;
+  if (x1 - x0 >= 256 || y1 - y0 >= 256) {
+    return {0, 255};  // every hash value
+  }
+
+  int lo = 255;
+  int hi = 0;
+  for (int x = x0; x <= x1; x++) {
+    for (int y = y0; y <= y1; y++) {
+      int value = hash_[(hash_[y & 255] + x) & 255];
+      lo = std::min(lo, value);
+      hi = std::max(hi, value);
+    }
+  }
+  return {static_cast<float>(lo), static_cast<float>(hi)};
+}
+
+void Perlin::perlin2d_grid(float x0, float y0, int size_x, int size_y,
+                          float freq, int depth, float* out) const {
+  std::fill(out, out + static_cast<size_t>(size_x) * size_y, 0.0f);
+  std::vector<float> y_fades(size_y);
+  // First sample of each run of samples in the same lattice cell along y,
+  // with the cell, and size_y to close the last run.
+  std::vector<int> run_starts;
+  std::vector<int> run_cells;
+
+  float amp = 1.0;
+  float div = 0.0;
+  float octave_scale = 1;
+  for (int octave = 0; octave < depth; octave++) {
+    div += 256 * amp;
+    // Same coordinates as perlin2d(): x * freq doubled once per octave.
+    run_starts.clear();
+    run_cells.clear();
+    for (int k = 0; k < size_y; k++) {
+      float ya = (y0 + k) * freq * octave_scale;
+      int y_int = static_cast<int>(std::floor(ya));
+      float y_frac = ya - y_int;
+      y_fades[k] = y_frac * y_frac * (3 - 2 * y_frac);
+      if (run_cells.empty() || run_cells.back() != y_int) {
+        run_starts.push_back(k);
+        run_cells.push_back(y_int);
+      }
+    }
+    run_starts.push_back(size_y);
+
+    for (int i = 0; i < size_x; i++) {
+      float xa = (x0 + i) * freq * octave_scale;
+      int x_int = static_cast<int>(std::floor(xa));
+      float x_frac = xa - x_int;
+      float* row = out + static_cast<size_t>(i) * size_y;
+
+      // The corners and x interpolation once per cell, then only the y
+      // interpolation for each sample of the run.
+      for (size_t run = 0; run < run_cells.size(); run++) {
+        int y_int = run_cells[run];
+        float low = smooth_inter(noise(x_int, y_int), noise(x_int + 1, y_int),
+                                 x_frac);
+        float high = smooth_inter(noise(x_int, y_int + 1),
+                                  noise(x_int + 1, y_int + 1), x_frac);
+        for (int k = run_starts[run]; k < run_starts[run + 1]; k++) {
+          row[k] += lin_inter(low, high, y_fades[k]) * amp;
+        }
+      }
+    }
+    amp /= 2;
+    octave_scale *= 2;
+  }
+
+  for (size_t i = 0; i < static_cast<size_t>(size_x) * size_y; i++) {
+    out[i] /= div;
+  }
+}
+
+// Dot product of the offset with one of the 12 cube edge directions.
+static float Gradient(int hash, float x, float y, float z) {
+  int h = hash & 15;
+  float u = h < 8 ? x : y;
+  float v = h < 4 ? y : (h == 12 || h == 14 ? x : z);
+  return ((h & 1) == 0 ? u : -u) + ((h & 2) == 0 ? v : -v);
+}
+
+static float Fade(float t) { return t * t * t * (t * (t * 6 - 15) + 10); }
+
+float Perlin::noise3d(float x, float y, float z) const {
+  float x_floor = std::floor(x);
+  float y_floor = std::floor(y);
+  float z_floor = std::floor(z);
+  int xi = static_cast<int>(x_floor);
+  int yi = static_cast<int>(y_floor);
+  int zi = static_cast<int>(z_floor);
+  x -= x_floor;
+  y -= y_floor;
+  z -= z_floor;
+
+  auto hash = [this](int x, int y, int z) {
+    return hash_[(hash_[(hash_[z & 255] + y) & 255] + x) & 255];
+  };
+  auto lerp = [](float a, float b, float t) { return a + t * (b - a); };
+  float u = Fade(x);
+  float v = Fade(y);
+  float w = Fade(z);
+
+  float corners[2][2];
+  for (int dz = 0; dz < 2; dz++) {
+    for (int dy = 0; dy < 2; dy++) {
+      float g0 = Gradient(hash(xi, yi + dy, zi + dz), x, y - dy, z - dz);
+      float g1 = Gradient(hash(xi + 1, yi + dy, zi + dz), x - 1, y - dy,
+                          z - dz);
+      corners[dz][dy] = lerp(g0, g1, u);
+    }
+  }
+  return lerp(lerp(corners[0][0], corners[0][1], v),
+              lerp(corners[1][0], corners[1][1], v), w);
+}
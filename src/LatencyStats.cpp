@@ -0,0 +1,24 @@
+#include "LatencyStats.h"
+
+#include <algorithm>
+
+void LatencyStats::Add(float milliseconds) {
+  if (samples_.size() < kWindow) {
+    samples_.push_back(milliseconds);
+    return;
+  }
+  samples_[next_] = milliseconds;
+  next_ = (next_ + 1) % kWindow;
+}
+
+float LatencyStats::Percentile(float fraction) const {
+  if (samples_.empty()) {
+    return 0;
+  }
+
+  std::vector<float> sorted = samples_;
+  size_t rank = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5f);
+  rank = std::min(rank, sorted.size() - 1);
+  std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+  return sorted[rank];
+}
@@ -0,0 +1,87 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() { Close(); }
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const std::string& path) {
+  Close();
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  void* view = mapping != NULL
+                   ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)
+                   : NULL;
+  if (view == NULL) {
+    if (mapping != NULL) CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+  file_ = file;
+  mapping_ = mapping;
+  data_ = static_cast<const uint8_t*>(view);
+  size_ = static_cast<size_t>(size.QuadPart);
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_ != nullptr) UnmapViewOfFile(data_);
+  if (mapping_ != nullptr) CloseHandle(mapping_);
+  if (file_ != nullptr) CloseHandle(file_);
+  data_ = nullptr;
+  size_ = 0;
+  mapping_ = nullptr;
+  file_ = nullptr;
+}
+
+#else
+
+bool MappedFile::Open(const std::string& path) {
+  Close();
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  void* view = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (view == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+  fd_ = fd;
+  data_ = static_cast<const uint8_t*>(view);
+  size_ = static_cast<size_t>(info.st_size);
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_ != nullptr) munmap(const_cast<uint8_t*>(data_), size_);
+  if (fd_ >= 0) close(fd_);
+  data_ = nullptr;
+  size_ = 0;
+  fd_ = -1;
+}
+
+#endif
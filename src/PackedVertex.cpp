@@ -0,0 +1,58 @@
+#include "PackedVertex.h"
+
+void PackedGeometryBuilder::ReserveFaces(size_t faces) {
+  vertices_.reserve(vertices_.size() + faces * 4);
+  indices_.reserve(indices_.size() + faces * 6);
+}
+
+void PackedGeometryBuilder::PushCube(int x, int y, int z, uint8_t color_index,
+                                     uint8_t faces) {
+  const int min[3] = {x, y, z};
+  const int max[3] = {x + 1, y + 1, z + 1};
+  for (int face = 0; face < kFaceCount; face++) {
+    if ((faces & (1 << face)) != 0) {
+      PushBoxFace(static_cast<CubeFace>(face), min, max, color_index);
+    }
+  }
+}
+
+void PackedGeometryBuilder::PushBoxFace(CubeFace face, const int min[3],
+                                        const int max[3],
+                                        uint8_t color_index) {
+  uint32_t offset = vertices_.size();
+
+  for (int corner = 0; corner < 4; corner++) {
+    const float* c = kCubeCorners[face * 4 + corner];
+    vertices_.push_back(PackedVertex::Pack(
+        c[0] < 0 ? min[0] : max[0], c[1] < 0 ? min[1] : max[1],
+        c[2] < 0 ? min[2] : max[2], face, corner, color_index));
+  }
+
+  for (int i = 0; i < 6; ++i) {
+    indices_.push_back(kFaceIndices[i] + offset);
+  }
+}
+
+Vertex UnpackVertex(PackedVertex vertex, const int origin[3], float scale,
+                    const std::vector<Vec3>& palette) {
+  // Packed corners sit half a voxel away from the voxel centers that
+  // GeometryBuilder positions are built from.
+  Vec3 position = Vec3(origin[0] + vertex.x() - 0.5f,
+                       origin[1] + vertex.y() - 0.5f,
+                       origin[2] + vertex.z() - 0.5f);
+  Vec3 color = vertex.face() == kFaceUp ? palette[vertex.color_index()]
+                                        : kDirtColor;
+  return {position * scale, Vec2(), color};
+}
+
+GeometryBuilder UnpackMesh(const PackedGeometryBuilder& mesh,
+                           const int origin[3], float scale,
+                           const std::vector<Vec3>& palette) {
+  GeometryBuilder result;
+  result.vertices_.reserve(mesh.vertices_.size());
+  for (const PackedVertex& vertex : mesh.vertices_) {
+    result.vertices_.push_back(UnpackVertex(vertex, origin, scale, palette));
+  }
+  result.indices_ = mesh.indices_;
+  return result;
+}
@@ -0,0 +1,195 @@
+#include "PaletteStorage.h"
+
+#include <algorithm>
+
+namespace {
+// Smallest supported index width able to address `entries` palette entries.
+int BitsFor(size_t entries) {
+  if (entries <= 1) return 0;
+  if (entries <= 2) return 1;
+  if (entries <= 4) return 2;
+  if (entries <= 16) return 4;
+  return 8;
+}
+}  // namespace
+
+PaletteStorage::PaletteStorage(size_t size, VoxelId fill)
+    : size_(size), palette_{fill} {}
+
+uint32_t PaletteStorage::GetIndex(size_t index) const {
+  if (bits_ == 0) {
+    return 0;
+  }
+  size_t bit = index * bits_;
+  return (words_[bit >> 6] >> (bit & 63)) & ((1ull << bits_) - 1);
+}
+
+void PaletteStorage::SetIndex(size_t index, uint32_t palette_index) {
+  size_t bit = index * bits_;
+  uint64_t mask = ((1ull << bits_) - 1) << (bit & 63);
+  uint64_t& word = words_[bit >> 6];
+  word = (word & ~mask) | (static_cast<uint64_t>(palette_index) << (bit & 63));
+}
+
+uint32_t PaletteStorage::IndexOf(VoxelId id) {
+  auto it = std::find(palette_.begin(), palette_.end(), id);
+  if (it != palette_.end()) {
+    return static_cast<uint32_t>(it - palette_.begin());
+  }
+  palette_.push_back(id);
+  int bits = BitsFor(palette_.size());
+  if (bits != bits_) {
+    Repack(bits);
+  }
+  return static_cast<uint32_t>(palette_.size() - 1);
+}
+
+void PaletteStorage::Repack(int bits) {
+  std::vector<uint64_t> words((size_ * bits + 63) / 64, 0);
+  if (bits_ != 0) {
+    for (size_t i = 0; i < size_; i++) {
+      size_t bit = i * bits;
+      words[bit >> 6] |= static_cast<uint64_t>(GetIndex(i)) << (bit & 63);
+    }
+  }
+  // From 0 bits every index is 0, which the zeroed words already hold.
+  words_.swap(words);
+  bits_ = bits;
+}
+
+bool PaletteStorage::Assign(int bits, std::span<const VoxelId> palette,
+                            std::span<const uint64_t> words) {
+  if (palette.empty() || BitsFor(palette.size()) > bits ||
+      (bits != 0 && bits != 1 && bits != 2 && bits != 4 && bits != 8) ||
+      words.size() != (size_ * bits + 63) / 64) {
+    return false;
+  }
+  if (bits != 0 && palette.size() < (1u << bits)) {
+    // Indices past the palette would read out of it later.
+    const uint64_t mask = (1ull << bits) - 1;
+    for (size_t i = 0; i < size_; i++) {
+      size_t bit = i * bits;
+      if (((words[bit >> 6] >> (bit & 63)) & mask) >= palette.size()) {
+        return false;
+      }
+    }
+  }
+  bits_ = bits;
+  palette_.assign(palette.begin(), palette.end());
+  words_.assign(words.begin(), words.end());
+  return true;
+}
+
+void PaletteStorage::Set(size_t index, VoxelId id) {
+  if (bits_ == 0 && palette_[0] == id) {
+    return;
+  }
+  SetIndex(index, IndexOf(id));
+}
+
+void PaletteStorage::GetRange(size_t first, size_t count,
+                              VoxelId* out) const {
+  if (bits_ == 0) {
+    std::fill(out, out + count, palette_[0]);
+    return;
+  }
+  // Decodes word by word rather than recomputing the word of every index.
+  const uint64_t mask = (1ull << bits_) - 1;
+  size_t bit = first * bits_;
+  size_t end = bit + count * bits_;
+  while (bit < end) {
+    uint64_t word = words_[bit >> 6] >> (bit & 63);
+    size_t word_end = std::min((bit | 63) + 1, end);
+    for (; bit < word_end; bit += bits_) {
+      *out++ = palette_[word & mask];
+      word >>= bits_;
+    }
+  }
+}
+
+void PaletteStorage::SetRange(size_t first, size_t count, VoxelId id) {
+  if (count == 0 || (bits_ == 0 && palette_[0] == id)) {
+    return;
+  }
+  if (first == 0 && count == size_) {
+    // Whole array: back to a uniform single entry palette.
+    palette_.assign(1, id);
+    words_.clear();
+    bits_ = 0;
+    return;
+  }
+
+  uint32_t palette_index = IndexOf(id);
+  size_t end = first + count;
+  size_t per_word = 64 / bits_;
+
+  // Head and tail one index at a time, whole words in between with the index
+  // repeated across the word.
+  size_t i = first;
+  for (; i < end && i % per_word != 0; i++) {
+    SetIndex(i, palette_index);
+  }
+  if (end - i >= per_word) {
+    uint64_t pattern = 0;
+    for (size_t j = 0; j < per_word; j++) {
+      pattern |= static_cast<uint64_t>(palette_index) << (j * bits_);
+    }
+    size_t whole_words = (end - i) / per_word;
+    std::fill_n(words_.begin() + i / per_word, whole_words, pattern);
+    i += whole_words * per_word;
+  }
+  for (; i < end; i++) {
+    SetIndex(i, palette_index);
+  }
+}
+
+size_t PaletteStorage::Count(VoxelId id) const {
+  auto it = std::find(palette_.begin(), palette_.end(), id);
+  if (it == palette_.end()) {
+    return 0;
+  }
+  if (bits_ == 0) {
+    return size_;
+  }
+  uint32_t palette_index = static_cast<uint32_t>(it - palette_.begin());
+  size_t count = 0;
+  for (size_t i = 0; i < size_; i++) {
+    count += GetIndex(i) == palette_index;
+  }
+  return count;
+}
+
+void PaletteStorage::Compact() {
+  if (bits_ == 0) {
+    return;
+  }
+  std::vector<size_t> uses(palette_.size(), 0);
+  for (size_t i = 0; i < size_; i++) {
+    uses[GetIndex(i)]++;
+  }
+
+  std::vector<VoxelId> palette;
+  std::vector<uint32_t> remap(palette_.size(), 0);
+  for (size_t p = 0; p < palette_.size(); p++) {
+    if (uses[p] > 0) {
+      remap[p] = static_cast<uint32_t>(palette.size());
+      palette.push_back(palette_[p]);
+    }
+  }
+  if (palette.size() == palette_.size()) {
+    return;
+  }
+
+  int bits = BitsFor(palette.size());
+  std::vector<uint64_t> words((size_ * bits + 63) / 64, 0);
+  if (bits != 0) {
+    for (size_t i = 0; i < size_; i++) {
+      size_t bit = i * bits;
+      words[bit >> 6] |= static_cast<uint64_t>(remap[GetIndex(i)])
+                         << (bit & 63);
+    }
+  }
+  palette_.swap(palette);
+  words_.swap(words);
+  bits_ = bits;
+}
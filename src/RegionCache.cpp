@@ -0,0 +1,431 @@
+#include "RegionCache.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+namespace {
+
+constexpr uint32_t kMagic = 0x43525856;  // "VXRC"
+constexpr uint32_t kFormatVersion = 1;
+constexpr int kSlotCount = kRegionSize * kRegionSize;
+
+struct ColumnSlot {
+  uint64_t offset;  // 0 when the column is not cached
+  uint64_t size;
+  uint64_t mesh_key;  // 0 when only the voxels were stored
+};
+
+struct RegionHeader {
+  uint32_t magic;
+  uint32_t format_version;
+  uint64_t seed;
+  uint64_t generator_key;
+  int32_t rx;
+  int32_t rz;
+  ColumnSlot slots[kSlotCount];
+};
+
+// A column record is a ColumnRecord then chunk_count chunks. A chunk is a
+// ChunkRecord, its palette and its index words, then mesh_count meshes. A
+// mesh is a MeshRecord, its vertices and its indices. Every part starts on
+// 8 bytes.
+struct ColumnRecord {
+  uint32_t chunk_count;
+  uint32_t reserved;
+};
+
+struct ChunkRecord {
+  int32_t cy;
+  uint32_t bits;
+  uint32_t palette_size;
+  uint32_t mesh_count;
+};
+
+struct MeshRecord {
+  uint32_t vertex_count;
+  uint32_t index_count;
+  uint32_t index_size;
+  uint32_t reserved;
+};
+
+size_t Align8(size_t offset) { return (offset + 7) & ~size_t{7}; }
+
+uint64_t Fnv1a(uint64_t hash, const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+template <typename T>
+uint64_t Fnv1a(uint64_t hash, const T& value) {
+  return Fnv1a(hash, &value, sizeof(value));
+}
+
+// File offsets on 64 bits, long is only 32 bits on Windows.
+int64_t Tell(FILE* file) {
+#ifdef _WIN32
+  return _ftelli64(file);
+#else
+  return ftello(file);
+#endif
+}
+
+int Seek(FILE* file, int64_t offset, int origin) {
+#ifdef _WIN32
+  return _fseeki64(file, offset, origin);
+#else
+  return fseeko(file, offset, origin);
+#endif
+}
+
+// Bytes of the header and of the records the slots point to.
+uint64_t LiveBytes(const RegionHeader& header) {
+  uint64_t bytes = sizeof(RegionHeader);
+  for (const ColumnSlot& slot : header.slots) {
+    if (slot.offset != 0) {
+      bytes += Align8(slot.size);
+    }
+  }
+  return bytes;
+}
+
+// Rewrites the region file at `path` with only the records `header` points
+// to, through a temporary file swapped in once complete: the region is left
+// untouched when anything fails.
+void CompactRegion(const std::string& path, RegionHeader header) {
+  std::string temp_path = path + ".tmp";
+  FILE* in = fopen(path.c_str(), "rb");
+  FILE* out = fopen(temp_path.c_str(), "wb");
+  bool ok = in != nullptr && out != nullptr &&
+            fwrite(&header, sizeof(header), 1, out) == 1;
+
+  uint64_t end = sizeof(RegionHeader);
+  std::vector<uint8_t> record;
+  for (ColumnSlot& slot : header.slots) {
+    if (!ok) {
+      break;
+    }
+    if (slot.offset == 0) {
+      continue;
+    }
+    record.assign(Align8(slot.size), 0);
+    ok = Seek(in, slot.offset, SEEK_SET) == 0 &&
+         fread(record.data(), 1, slot.size, in) == slot.size &&
+         fwrite(record.data(), 1, record.size(), out) == record.size();
+    slot.offset = end;
+    end += record.size();
+  }
+  // The slots again, with the new offsets.
+  ok = ok && Seek(out, 0, SEEK_SET) == 0 &&
+       fwrite(&header, sizeof(header), 1, out) == 1;
+
+  if (in != nullptr) {
+    fclose(in);
+  }
+  if (out != nullptr) {
+    ok = fclose(out) == 0 && ok;
+  }
+  std::error_code error;
+  if (ok) {
+    std::filesystem::rename(temp_path, path, error);
+  }
+  if (!ok || error) {
+    std::filesystem::remove(temp_path, error);
+  }
+}
+
+void Append(std::vector<uint8_t>& out, const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  out.insert(out.end(), bytes, bytes + size);
+  out.resize(Align8(out.size()), 0);
+}
+
+// Bounds checked reads out of a mapped record.
+class RecordReader {
+ public:
+  RecordReader(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+  template <typename T>
+  const T* Read(size_t count = 1) {
+    size_t bytes = sizeof(T) * count;
+    if (bytes > size_ - pos_) {
+      return nullptr;
+    }
+    const T* result = reinterpret_cast<const T*>(data_ + pos_);
+    pos_ = std::min(Align8(pos_ + bytes), size_);
+    return result;
+  }
+
+ private:
+  const uint8_t* data_;
+  size_t size_;
+  size_t pos_ = 0;
+};
+
+bool ReadMesh(RecordReader& reader, GeometryBuilder& mesh) {
+  const MeshRecord* record = reader.Read<MeshRecord>();
+  if (record == nullptr ||
+      (record->index_size != 2 && record->index_size != 4)) {
+    return false;
+  }
+  const Vertex* vertices = reader.Read<Vertex>(record->vertex_count);
+  const uint8_t* indices =
+      reader.Read<uint8_t>(record->index_count * record->index_size);
+  if (vertices == nullptr || indices == nullptr) {
+    return false;
+  }
+
+  mesh = GeometryBuilder();
+  mesh.vertices_.assign(vertices, vertices + record->vertex_count);
+  if (record->index_size == 2) {
+    mesh.index_format_ = IndexFormat::kUInt16;
+    mesh.indices16_.resize(record->index_count);
+    std::memcpy(mesh.indices16_.data(), indices, record->index_count * 2);
+  } else {
+    mesh.index_format_ = IndexFormat::kUInt32;
+    mesh.indices_.resize(record->index_count);
+    std::memcpy(mesh.indices_.data(), indices, record->index_count * 4);
+  }
+  return true;
+}
+
+}  // namespace
+
+RegionCache::RegionCache(std::string directory,
+                         const TerrainGenerator& generator,
+                         const ChunkGrid& grid)
+    : directory_(std::move(directory)),
+      seed_(generator.seed_),
+      generator_key_(GeneratorKey(generator)),
+      mesh_key_(MeshKey(grid)) {
+  std::error_code error;
+  std::filesystem::create_directories(directory_, error);
+}
+
+uint64_t RegionCache::GeneratorKey(const TerrainGenerator& generator) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  hash = Fnv1a(hash, TerrainGenerator::kVersion);
+  hash = Fnv1a(hash, kChunkSize);
+  hash = Fnv1a(hash, generator.seed_);
+  // The table rather than the seed alone, perlin_ can be replaced.
+  hash = Fnv1a(hash, generator.perlin_.hash_.data(),
+               generator.perlin_.hash_.size() * sizeof(int));
+  hash = Fnv1a(hash, generator.size_xz_);
+  hash = Fnv1a(hash, generator.size_y_);
+  hash = Fnv1a(hash, generator.min_y_);
+  hash = Fnv1a(hash, generator.overhang_amplitude_);
+  hash = Fnv1a(hash, generator.overhang_frequency_);
+  hash = Fnv1a(hash, generator.checkerboard_);
+  return hash;
+}
+
+uint64_t RegionCache::MeshKey(const ChunkGrid& grid) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  hash = Fnv1a(hash, ChunkGrid::kMeshVersion);
+  hash = Fnv1a(hash, kLodCount);
+  hash = Fnv1a(hash, sizeof(Vertex));
+  hash = Fnv1a(hash, grid.mesh_mode_);
+  hash = Fnv1a(hash, grid.weld_vertices_);
+  hash = Fnv1a(hash, grid.optimize_vertex_cache_);
+  hash = Fnv1a(hash, grid.ambient_occlusion_);
+  hash = Fnv1a(hash, grid.build_lods_);
+  hash = Fnv1a(hash, grid.voxel_scale());
+  hash = Fnv1a(hash, grid.palette_.data(),
+               grid.palette_.size() * sizeof(grid.palette_[0]));
+  return hash == 0 ? 1 : hash;
+}
+
+std::string RegionCache::RegionPath(int rx, int rz) const {
+  char name[64];
+  snprintf(name, sizeof(name), "r.%016llx.%d.%d.bin",
+           static_cast<unsigned long long>(generator_key_), rx, rz);
+  return (std::filesystem::path(directory_) / name).string();
+}
+
+const MappedFile* RegionCache::MapRegion(int rx, int rz) {
+  std::unique_ptr<Region>& region = regions_[{rx, rz}];
+  if (region == nullptr) {
+    region = std::make_unique<Region>();
+  }
+  if (region->stale) {
+    region->stale = false;
+    if (!region->file.Open(RegionPath(rx, rz))) {
+      return nullptr;
+    }
+  }
+  if (!region->file.is_open() ||
+      region->file.size() < sizeof(RegionHeader)) {
+    return nullptr;
+  }
+  const RegionHeader* header =
+      reinterpret_cast<const RegionHeader*>(region->file.data());
+  if (header->magic != kMagic || header->format_version != kFormatVersion ||
+      header->generator_key != generator_key_) {
+    return nullptr;
+  }
+  return &region->file;
+}
+
+bool RegionCache::LoadColumn(ColumnCoord coord,
+                             std::vector<std::pair<int, Chunk>>& chunks,
+                             bool* meshed) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int rx = coord.x >> kRegionShift;
+  int rz = coord.z >> kRegionShift;
+  const MappedFile* file = MapRegion(rx, rz);
+  if (file == nullptr) {
+    return false;
+  }
+
+  const RegionHeader* header =
+      reinterpret_cast<const RegionHeader*>(file->data());
+  int slot_index = (coord.x & (kRegionSize - 1)) * kRegionSize +
+                   (coord.z & (kRegionSize - 1));
+  const ColumnSlot& slot = header->slots[slot_index];
+  if (slot.offset == 0 || slot.offset % 8 != 0 || slot.offset > file->size() ||
+      slot.size > file->size() - slot.offset) {
+    return false;
+  }
+
+  RecordReader reader(file->data() + slot.offset, slot.size);
+  const ColumnRecord* column = reader.Read<ColumnRecord>();
+  if (column == nullptr) {
+    return false;
+  }
+  bool has_meshes = slot.mesh_key == mesh_key_;
+
+  chunks.clear();
+  for (uint32_t i = 0; i < column->chunk_count; i++) {
+    const ChunkRecord* record = reader.Read<ChunkRecord>();
+    if (record == nullptr || record->bits > 8 ||
+        (record->mesh_count != 0 && record->mesh_count != kLodCount)) {
+      return false;
+    }
+    const VoxelId* palette = reader.Read<VoxelId>(record->palette_size);
+    size_t word_count = (kChunkVolume * record->bits + 63) / 64;
+    const uint64_t* words = reader.Read<uint64_t>(word_count);
+    if (palette == nullptr || words == nullptr) {
+      return false;
+    }
+
+    Chunk& chunk = chunks.emplace_back(record->cy, Chunk()).second;
+    if (!chunk.voxels_.Assign(record->bits,
+                              {palette, record->palette_size},
+                              {words, word_count})) {
+      return false;
+    }
+    for (uint32_t lod = 0; lod < record->mesh_count; lod++) {
+      GeometryBuilder& mesh =
+          lod == 0 ? chunk.mesh_ : chunk.lod_meshes_[lod - 1];
+      if (!ReadMesh(reader, mesh)) {
+        return false;
+      }
+    }
+    chunk.octree_.Build(chunk.voxels_);
+    if (!has_meshes) {
+      // Built with other settings, the chunk gets meshed again.
+      chunk.mesh_ = GeometryBuilder();
+      chunk.lod_meshes_ = {};
+    }
+  }
+  *meshed = has_meshes;
+  return true;
+}
+
+bool RegionCache::StoreColumn(
+    ColumnCoord coord, const std::vector<std::pair<int, const Chunk*>>& chunks,
+    bool meshed) {
+  std::vector<uint8_t> record;
+  ColumnRecord column = {static_cast<uint32_t>(chunks.size()), 0};
+  Append(record, &column, sizeof(column));
+  for (const auto& [cy, chunk] : chunks) {
+    const PaletteStorage& voxels = chunk->voxels_;
+    ChunkRecord header = {cy, static_cast<uint32_t>(voxels.bits_per_index()),
+                          static_cast<uint32_t>(voxels.palette().size()),
+                          meshed ? static_cast<uint32_t>(kLodCount) : 0};
+    Append(record, &header, sizeof(header));
+    Append(record, voxels.palette().data(), voxels.palette().size());
+    Append(record, voxels.words().data(),
+           voxels.words().size() * sizeof(uint64_t));
+    for (uint32_t lod = 0; lod < header.mesh_count; lod++) {
+      const GeometryBuilder& mesh = chunk->Mesh(lod);
+      MeshRecord mesh_header = {
+          static_cast<uint32_t>(mesh.vertices_.size()),
+          static_cast<uint32_t>(mesh.index_count()),
+          static_cast<uint32_t>(mesh.index_size()), 0};
+      Append(record, &mesh_header, sizeof(mesh_header));
+      Append(record, mesh.vertices_.data(),
+             mesh.vertices_.size() * sizeof(Vertex));
+      Append(record, mesh.index_data(), mesh.index_count() * mesh.index_size());
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  int rx = coord.x >> kRegionShift;
+  int rz = coord.z >> kRegionShift;
+  // Unmapped first, a mapped file cannot be written to on Windows.
+  std::unique_ptr<Region>& region = regions_[{rx, rz}];
+  if (region == nullptr) {
+    region = std::make_unique<Region>();
+  }
+  region->file.Close();
+  region->stale = true;
+
+  std::string path = RegionPath(rx, rz);
+  FILE* file = fopen(path.c_str(), "r+b");
+  RegionHeader header;
+  if (file != nullptr &&
+      (fread(&header, sizeof(header), 1, file) != 1 ||
+       header.magic != kMagic || header.format_version != kFormatVersion ||
+       header.generator_key != generator_key_)) {
+    fclose(file);
+    file = nullptr;
+  }
+  if (file == nullptr) {
+    // Missing or from another generator: start an empty region.
+    file = fopen(path.c_str(), "w+b");
+    if (file == nullptr) {
+      return false;
+    }
+    header = {kMagic, kFormatVersion, seed_, generator_key_, rx, rz, {}};
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+      fclose(file);
+      return false;
+    }
+  }
+
+  // Records are appended, a replaced record stays behind as dead bytes until
+  // the region is compacted.
+  int64_t end = Seek(file, 0, SEEK_END) == 0 ? Tell(file) : -1;
+  if (end < 0) {
+    fclose(file);
+    return false;
+  }
+  uint64_t offset = Align8(static_cast<uint64_t>(end));
+  const uint8_t padding[8] = {};
+  ColumnSlot slot = {offset, record.size(), meshed ? mesh_key_ : 0};
+  int slot_index = (coord.x & (kRegionSize - 1)) * kRegionSize +
+                   (coord.z & (kRegionSize - 1));
+  header.slots[slot_index] = slot;
+  bool ok = fwrite(padding, 1, offset - end, file) == offset - end &&
+            fwrite(record.data(), 1, record.size(), file) == record.size() &&
+            Seek(file,
+                 offsetof(RegionHeader, slots) +
+                     slot_index * sizeof(ColumnSlot),
+                 SEEK_SET) == 0 &&
+            fwrite(&slot, sizeof(slot), 1, file) == 1;
+  ok = fclose(file) == 0 && ok;
+
+  // Every mesh settings change appends whole columns again, so the dead
+  // records are dropped once they outweigh the live ones.
+  uint64_t live = LiveBytes(header);
+  if (ok && offset + record.size() - live > live) {
+    CompactRegion(path, header);
+  }
+  return ok;
+}
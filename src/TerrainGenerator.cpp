@@ -0,0 +1,342 @@
+#include "TerrainGenerator.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <random>
+
+// Noise shapes of the terrain: rolling hills plus small bumps on top.
+using HillNoise = Fbm<3>;
+using DetailNoise = Fbm<1>;
+
+TerrainGenerator::TerrainGenerator()
+    : TerrainGenerator(std::random_device()()) {}
+
+TerrainGenerator::TerrainGenerator(uint64_t seed)
+    : seed_(seed), perlin_(seed) {}
+
+float TerrainGenerator::ColumnHeight(int x, int z) const {
+  float secondary_noise = DetailNoise(perlin_)(x, z, 0.11f);
+  float height = HillNoise(perlin_)(x + 100, z, 0.03f) * size_y_;
+  height -= 10;
+  height += secondary_noise * 4;
+  return height;
+}
+
+VoxelId TerrainGenerator::ColumnMaterial(int x, int z) const {
+  return checkerboard_ && (x + z) % 2 != 0 ? kGrassDark : kGrassLight;
+}
+
+void TerrainGenerator::ComputeHeights(int x0, int z0, int size_x, int size_z,
+                                      float* heights) const {
+  int half = size_xz_ / 2;
+  size_t count = static_cast<size_t>(size_x) * size_z;
+
+  // One grid pass per noise layer, samples in the same lattice cell share
+  // its corners, then a last pass combining the layers.
+  std::vector<float> detail(count);
+  HillNoise hills(perlin_);
+  DetailNoise details(perlin_);
+  hills.Grid(static_cast<float>(x0 + half + 100),
+             static_cast<float>(z0 + half), size_x, size_z, 0.03f, heights);
+  details.Grid(static_cast<float>(x0 + half), static_cast<float>(z0 + half),
+               size_x, size_z, 0.11f, detail.data());
+  for (size_t i = 0; i < count; i++) {
+    heights[i] = heights[i] * size_y_ - 10 + detail[i] * 4;
+  }
+
+  if (size_xz_ == 0) {
+    return;
+  }
+  for (int i = 0; i < size_x; i++) {
+    for (int k = 0; k < size_z; k++) {
+      int x = x0 + i + half;
+      int z = z0 + k + half;
+      if (x < 0 || x >= size_xz_ || z < 0 || z >= size_xz_) {
+        heights[i * size_z + k] = -INFINITY;
+      }
+    }
+  }
+}
+
+NoiseBounds TerrainGenerator::HeightBounds(int x0, int z0, int size_x,
+                                           int size_z) const {
+  int half = size_xz_ / 2;
+  float x_min = static_cast<float>(x0 + half);
+  float z_min = static_cast<float>(z0 + half);
+  float x_max = static_cast<float>(x0 + half + size_x - 1);
+  float z_max = static_cast<float>(z0 + half + size_z - 1);
+  NoiseBounds hills =
+      HillNoise(perlin_).Bounds(x_min + 100, z_min, x_max + 100, z_max, 0.03f);
+  NoiseBounds details =
+      DetailNoise(perlin_).Bounds(x_min, z_min, x_max, z_max, 0.11f);
+
+  // Same combination as ComputeHeights(), widened a little for the rounding
+  // of the interpolations since ceil() of the height is what matters.
+  constexpr float kMargin = 1e-3f;
+  return {hills.min * size_y_ - 10 + details.min * 4 - kMargin,
+          hills.max * size_y_ - 10 + details.max * 4 + kMargin};
+}
+
+ChunkFill TerrainGenerator::ClassifyChunk(int cx, int cy, int cz) const {
+  int base_y = cy * kChunkSize;
+  if (base_y + kChunkSize <= min_y_) {
+    return ChunkFill::kAir;
+  }
+  int half = size_xz_ / 2;
+  int x0 = cx * kChunkSize + half;
+  int z0 = cz * kChunkSize + half;
+  bool inside = true;
+  if (size_xz_ != 0) {
+    if (x0 >= size_xz_ || z0 >= size_xz_ || x0 + kChunkSize <= 0 ||
+        z0 + kChunkSize <= 0) {
+      return ChunkFill::kAir;
+    }
+    inside = x0 >= 0 && z0 >= 0 && x0 + kChunkSize <= size_xz_ &&
+             z0 + kChunkSize <= size_xz_;
+  }
+
+  // A voxel is solid when ceil(height) - y plus the overhang noise, within
+  // the amplitude, is positive (see FillDensityChunk()).
+  NoiseBounds bounds = HeightBounds(cx * kChunkSize, cz * kChunkSize,
+                                    kChunkSize, kChunkSize);
+  int overhang = static_cast<int>(std::ceil(overhang_amplitude_));
+  if (static_cast<int>(std::ceil(bounds.max)) + overhang <= base_y) {
+    return ChunkFill::kAir;
+  }
+  if (inside && base_y >= min_y_ &&
+      base_y + kChunkSize + overhang <=
+          static_cast<int>(std::ceil(bounds.min))) {
+    return ChunkFill::kSolid;
+  }
+  return ChunkFill::kMixed;
+}
+
+void TerrainGenerator::ComputeColumn(int cx, int cz,
+                                     ChunkColumn& column) const {
+  column.cx = cx;
+  column.cz = cz;
+  ComputeHeights(cx * kChunkSize, cz * kChunkSize, kChunkSize, kChunkSize,
+                 column.heights);
+
+  column.top_y = min_y_;
+  for (float height : column.heights) {
+    if (height != -INFINITY) {
+      column.top_y =
+          std::max(column.top_y, static_cast<int>(std::ceil(height)));
+    }
+  }
+  // Overhangs can lift voxels up to the noise amplitude above the height.
+  if (column.top_y > min_y_ && overhang_amplitude_ > 0) {
+    column.top_y += static_cast<int>(std::ceil(overhang_amplitude_));
+  }
+}
+
+void TerrainGenerator::FillChunk(const ChunkColumn& column, int cy,
+                                 Chunk& chunk) const {
+  FillVoxels(column, cy, chunk);
+  // The voxels are written in bulk past the octree, built once at the end.
+  chunk.octree_.Build(chunk.voxels_);
+}
+
+void TerrainGenerator::FillVoxels(const ChunkColumn& column, int cy,
+                                  Chunk& chunk) const {
+  switch (ClassifyChunk(column.cx, cy, column.cz)) {
+    case ChunkFill::kAir:
+      return;
+    case ChunkFill::kSolid:
+      if (!checkerboard_) {
+        chunk.voxels_.SetRange(
+            0, kChunkVolume,
+            ColumnMaterial(column.cx * kChunkSize, column.cz * kChunkSize));
+        return;
+      }
+      for (int lx = 0; lx < kChunkSize; lx++) {
+        for (int lz = 0; lz < kChunkSize; lz++) {
+          chunk.voxels_.SetRange(
+              Chunk::Index(lx, 0, lz), kChunkSize,
+              ColumnMaterial(column.cx * kChunkSize + lx,
+                             column.cz * kChunkSize + lz));
+        }
+      }
+      return;
+    case ChunkFill::kMixed:
+      break;
+  }
+
+  if (overhang_amplitude_ > 0) {
+    FillDensityChunk(column, cy, chunk);
+    return;
+  }
+
+  int base_y = cy * kChunkSize;
+  for (int lx = 0; lx < kChunkSize; lx++) {
+    for (int lz = 0; lz < kChunkSize; lz++) {
+      float height = column.heights[lx * kChunkSize + lz];
+      if (height == -INFINITY) {
+        continue;  // outside the terrain
+      }
+      int x = column.cx * kChunkSize + lx;
+      int z = column.cz * kChunkSize + lz;
+      VoxelId id = ColumnMaterial(x, z);
+
+      // Same range as setting every ly >= y0 with base_y + ly < height,
+      // written as one run since columns are contiguous.
+      int y0 = std::max(min_y_ - base_y, 0);
+      int y1 =
+          std::min(static_cast<int>(std::ceil(height)) - base_y, kChunkSize);
+      if (y1 > y0) {
+        chunk.voxels_.SetRange(Chunk::Index(lx, y0, lz), y1 - y0, id);
+      }
+    }
+  }
+}
+
+void TerrainGenerator::FillDensityChunk(const ChunkColumn& column, int cy,
+                                        Chunk& chunk) const {
+  constexpr int kLattice = kChunkSize / kDensityStep + 1;
+  const int base[3] = {column.cx * kChunkSize, cy * kChunkSize,
+                       column.cz * kChunkSize};
+
+  // Overhangs span many voxels, so the noise is only evaluated on a coarse
+  // lattice, y being the fastest axis like the chunk.
+  std::array<float, kLattice * kLattice * kLattice> lattice;
+  for (int i = 0; i < kLattice; i++) {
+    for (int k = 0; k < kLattice; k++) {
+      for (int j = 0; j < kLattice; j++) {
+        lattice[(i * kLattice + k) * kLattice + j] =
+            overhang_amplitude_ *
+            perlin_.noise3d((base[0] + i * kDensityStep) * overhang_frequency_,
+                            (base[1] + j * kDensityStep) * overhang_frequency_,
+                            (base[2] + k * kDensityStep) * overhang_frequency_);
+      }
+    }
+  }
+
+  // Each column interpolates its lattice values along x and z first, then
+  // every voxel of the column along y in a loop without branches.
+  constexpr float kInvStep = 1.0f / kDensityStep;
+  float noise[kLattice];
+  bool solid[kChunkSize];
+  for (int lx = 0; lx < kChunkSize; lx++) {
+    for (int lz = 0; lz < kChunkSize; lz++) {
+      float height = column.heights[lx * kChunkSize + lz];
+      if (height == -INFINITY) {
+        continue;  // outside the terrain
+      }
+
+      int i = lx / kDensityStep;
+      int k = lz / kDensityStep;
+      float tx = (lx % kDensityStep) * kInvStep;
+      float tz = (lz % kDensityStep) * kInvStep;
+      const float* c00 = &lattice[(i * kLattice + k) * kLattice];
+      const float* c01 = c00 + kLattice;
+      const float* c10 = c00 + kLattice * kLattice;
+      const float* c11 = c10 + kLattice;
+      for (int j = 0; j < kLattice; j++) {
+        float low = c00[j] + tx * (c10[j] - c00[j]);
+        float high = c01[j] + tx * (c11[j] - c01[j]);
+        noise[j] = low + tz * (high - low);
+      }
+
+      // With no noise this is the FillChunk() range: min_y_ <= y < ceil(h).
+      float top = std::ceil(height) - base[1];
+      int bottom = min_y_ - base[1];
+      for (int ly = 0; ly < kChunkSize; ly++) {
+        int j = ly / kDensityStep;
+        float ty = (ly % kDensityStep) * kInvStep;
+        float density = top - ly + noise[j] + ty * (noise[j + 1] - noise[j]);
+        solid[ly] = density > 0 && ly >= bottom;
+      }
+
+      VoxelId id = ColumnMaterial(base[0] + lx, base[2] + lz);
+      for (int ly = 0; ly < kChunkSize;) {
+        if (!solid[ly]) {
+          ly++;
+          continue;
+        }
+        int end = ly + 1;
+        while (end < kChunkSize && solid[end]) {
+          end++;
+        }
+        chunk.voxels_.SetRange(Chunk::Index(lx, ly, lz), end - ly, id);
+        ly = end;
+      }
+    }
+  }
+}
+
+void TerrainGenerator::Generate(ChunkGrid& grid, ThreadPool& pool) {
+  int half = size_xz_ / 2;
+  ChunkCoord min = ChunkGrid::ToChunkCoord(-half, min_y_, -half);
+  ChunkCoord max =
+      ChunkGrid::ToChunkCoord(size_xz_ - 1 - half, min_y_, size_xz_ - 1 - half);
+  int columns_x = max.x - min.x + 1;
+  int columns_z = max.z - min.z + 1;
+
+  // First pass: the heights of every chunk column, in parallel.
+  std::vector<ChunkColumn> columns(columns_x * columns_z);
+  pool.ParallelFor(columns.size(), [&](size_t i) {
+    ComputeColumn(min.x + static_cast<int>(i) % columns_x,
+                  min.z + static_cast<int>(i) / columns_x, columns[i]);
+  });
+
+  // Chunks are created up front on this thread so the workers never touch the
+  // chunk map, each of them then only writes to its own chunk.
+  struct ChunkJob {
+    Chunk* chunk;
+    int cy;
+    const ChunkColumn* column;
+  };
+  std::vector<ChunkJob> jobs;
+  for (const ChunkColumn& column : columns) {
+    for (int cy = MinChunkY(); cy <= MaxChunkY(column); cy++) {
+      Chunk& chunk = grid.GetOrCreateChunk({column.cx, cy, column.cz});
+      chunk.dirty_ = true;
+      jobs.push_back({&chunk, cy, &column});
+    }
+  }
+
+  // Without overhangs the columns are solid from min_y_ to their height, a
+  // heightfield mesh then only needs the heights. Chunks are meshed here,
+  // straight from the columns, and RebuildDirty() has nothing left to do.
+  bool mesh_heights = grid.mesh_mode_ == MeshMode::kHeightfield &&
+                      overhang_amplitude_ == 0 && !grid.build_lods_;
+  auto column_top = [&](int x, int z) {
+    int cx = (x >> kChunkShift) - min.x;
+    int cz = (z >> kChunkShift) - min.z;
+    if (cx < 0 || cx >= columns_x || cz < 0 || cz >= columns_z) {
+      return min_y_;
+    }
+    int i = (x & kChunkMask) * kChunkSize + (z & kChunkMask);
+    float height = columns[cz * columns_x + cx].heights[i];
+    return height == -INFINITY ? min_y_ : static_cast<int>(std::ceil(height));
+  };
+
+  pool.ParallelFor(jobs.size(), [&](size_t i) {
+    const ChunkColumn& column = *jobs[i].column;
+    Chunk& chunk = *jobs[i].chunk;
+    FillChunk(column, jobs[i].cy, chunk);
+    if (!mesh_heights) {
+      return;
+    }
+
+    int x0 = column.cx * kChunkSize;
+    int z0 = column.cz * kChunkSize;
+    std::array<int, kPaddedSize * kPaddedSize> tops;
+    for (int x = -1; x <= kChunkSize; x++) {
+      for (int z = -1; z <= kChunkSize; z++) {
+        tops[(x + 1) * kPaddedSize + (z + 1)] = column_top(x0 + x, z0 + z);
+      }
+    }
+    std::array<VoxelId, kChunkSize * kChunkSize> materials;
+    for (int x = 0; x < kChunkSize; x++) {
+      for (int z = 0; z < kChunkSize; z++) {
+        materials[x * kChunkSize + z] = ColumnMaterial(x0 + x, z0 + z);
+      }
+    }
+    grid.MeshHeightfield({column.cx, jobs[i].cy, column.cz}, tops.data(),
+                         materials.data(), min_y_, chunk);
+    chunk.dirty_ = false;
+  });
+}
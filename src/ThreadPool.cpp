@@ -0,0 +1,82 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+
+ThreadPool::ThreadPool(size_t thread_count) {
+  if (thread_count == 0) {
+    thread_count = 1;
+  }
+  for (size_t i = 0; i < thread_count; i++) {
+    workers_.emplace_back([this] { WorkerLoop(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  job_available_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPool::Submit(std::function<void()> job) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.push_back(std::move(job));
+  }
+  job_available_.notify_one();
+}
+
+void ThreadPool::ParallelFor(size_t count,
+                             const std::function<void(size_t)>& fn) {
+  if (count == 0) {
+    return;
+  }
+
+  std::atomic<size_t> next = 0;
+  auto run = [&] {
+    for (size_t i = next++; i < count; i = next++) {
+      fn(i);
+    }
+  };
+
+  // Helpers reference this stack frame, wait for all of them before leaving.
+  size_t helper_count = std::min(thread_count(), count - 1);
+  size_t helpers_running = helper_count;
+  std::mutex done_mutex;
+  std::condition_variable done;
+  for (size_t h = 0; h < helper_count; h++) {
+    Submit([&] {
+      run();
+      std::lock_guard<std::mutex> lock(done_mutex);
+      if (--helpers_running == 0) {
+        done.notify_one();
+      }
+    });
+  }
+
+  run();
+
+  std::unique_lock<std::mutex> lock(done_mutex);
+  done.wait(lock, [&] { return helpers_running == 0; });
+}
+
+void ThreadPool::WorkerLoop() {
+  for (;;) {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      job_available_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+      if (stopping_ && jobs_.empty()) {
+        return;
+      }
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+    job();
+  }
+}
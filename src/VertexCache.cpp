@@ -0,0 +1,131 @@
+#include "VertexCache.h"
+
+VertexCacheStats SimulateVertexCache(std::span<const uint32_t> indices,
+                                     size_t vertex_count, size_t cache_size) {
+  // Each vertex remembers when it entered the cache, it is still cached while
+  // fewer than cache_size misses happened since then.
+  constexpr uint64_t kNever = UINT64_MAX;
+  std::vector<uint64_t> entered(vertex_count, kNever);
+  std::vector<bool> referenced(vertex_count, false);
+  uint64_t misses = 0;
+  size_t referenced_count = 0;
+
+  for (uint32_t index : indices) {
+    if (!referenced[index]) {
+      referenced[index] = true;
+      referenced_count++;
+    }
+    if (entered[index] == kNever || misses - entered[index] >= cache_size) {
+      entered[index] = misses++;
+    }
+  }
+
+  VertexCacheStats stats = {0, 0};
+  size_t triangle_count = indices.size() / 3;
+  if (triangle_count > 0) {
+    stats.acmr = static_cast<float>(misses) / triangle_count;
+  }
+  if (referenced_count > 0) {
+    stats.atvr = static_cast<float>(misses) / referenced_count;
+  }
+  return stats;
+}
+
+void OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertex_count,
+                         size_t cache_size) {
+  size_t triangle_count = indices.size() / 3;
+  if (triangle_count == 0) {
+    return;
+  }
+
+  // Vertex to triangle adjacency, in compressed rows.
+  std::vector<uint32_t> live(vertex_count, 0);
+  for (uint32_t index : indices) {
+    live[index]++;
+  }
+  std::vector<uint32_t> offsets(vertex_count + 1, 0);
+  for (size_t v = 0; v < vertex_count; v++) {
+    offsets[v + 1] = offsets[v] + live[v];
+  }
+  std::vector<uint32_t> adjacency(indices.size());
+  {
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++) {
+      adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+  }
+
+  std::vector<uint64_t> cache_time(vertex_count, 0);
+  std::vector<bool> emitted(triangle_count, false);
+  std::vector<uint32_t> dead_end;
+  std::vector<uint32_t> candidates;
+  std::vector<uint32_t> output;
+  output.reserve(indices.size());
+
+  const uint64_t k = cache_size;
+  uint64_t time = k + 1;
+  size_t cursor = 0;
+  int64_t fanning = 0;
+
+  while (fanning >= 0) {
+    candidates.clear();
+    for (uint32_t a = offsets[fanning]; a < offsets[fanning + 1]; a++) {
+      uint32_t triangle = adjacency[a];
+      if (emitted[triangle]) {
+        continue;
+      }
+
+      for (int corner = 0; corner < 3; corner++) {
+        uint32_t v = indices[triangle * 3 + corner];
+        output.push_back(v);
+        dead_end.push_back(v);
+        candidates.push_back(v);
+        live[v]--;
+        if (time - cache_time[v] > k) {
+          cache_time[v] = time++;
+        }
+      }
+      emitted[triangle] = true;
+    }
+
+    // Next fanning vertex: the candidate that stays in cache the longest
+    // while it still has triangles to emit.
+    int64_t best = -1;
+    int64_t best_priority = -1;
+    for (uint32_t v : candidates) {
+      if (live[v] == 0) {
+        continue;
+      }
+      int64_t priority = 0;
+      if (time - cache_time[v] + 2 * live[v] <= k) {
+        priority = time - cache_time[v];
+      }
+      if (priority > best_priority) {
+        best_priority = priority;
+        best = v;
+      }
+    }
+
+    if (best < 0) {
+      // Dead end: backtrack through recently emitted vertices, then fall back
+      // to the next vertex in input order.
+      while (!dead_end.empty()) {
+        uint32_t v = dead_end.back();
+        dead_end.pop_back();
+        if (live[v] > 0) {
+          best = v;
+          break;
+        }
+      }
+      while (best < 0 && cursor < vertex_count) {
+        if (live[cursor] > 0) {
+          best = cursor;
+        }
+        cursor++;
+      }
+    }
+    fanning = best;
+  }
+
+  indices.swap(output);
+}
@@ -0,0 +1,178 @@
+#include "VoxelOctree.h"
+
+VoxelOctree::VoxelOctree(int size) : size_(size), nodes_{{kLeaf, kAir}} {}
+
+void VoxelOctree::Build(const PaletteStorage& voxels) {
+  nodes_.clear();
+  free_.clear();
+  if (voxels.bits_per_index() == 0) {
+    nodes_.push_back({kLeaf, voxels.palette()[0]});
+    return;
+  }
+
+  // Pyramid of the ids from full resolution down to one cell, kMixed where a
+  // cell holds more than one id. Same column layout as the voxels.
+  constexpr int16_t kMixed = -1;
+  std::vector<std::vector<int16_t>> levels;
+  {
+    std::vector<VoxelId> ids(voxels.size());
+    voxels.GetRange(0, ids.size(), ids.data());
+    levels.emplace_back(ids.begin(), ids.end());
+  }
+  for (int size = size_ / 2; size >= 1; size /= 2) {
+    const std::vector<int16_t>& fine = levels.back();
+    int fine_size = size * 2;
+    auto fine_at = [&](int x, int y, int z) {
+      return fine[(x * fine_size + z) * fine_size + y];
+    };
+    std::vector<int16_t> coarse(size * size * size);
+    for (int x = 0; x < size; x++) {
+      for (int z = 0; z < size; z++) {
+        for (int y = 0; y < size; y++) {
+          int16_t id = fine_at(2 * x, 2 * y, 2 * z);
+          for (int octant = 1; octant < 8 && id != kMixed; octant++) {
+            if (fine_at(2 * x + (octant & 1), 2 * y + (octant >> 1 & 1),
+                        2 * z + (octant >> 2)) != id) {
+              id = kMixed;
+            }
+          }
+          coarse[(x * size + z) * size + y] = id;
+        }
+      }
+    }
+    levels.push_back(std::move(coarse));
+  }
+
+  // Top down, mixed cells get 8 children and uniform ones become leaves.
+  struct Pending {
+    uint32_t node;
+    int level;  // cells of this level are 2^level voxels wide
+    int x, y, z;  // in cells of that level
+  };
+  std::vector<Pending> stack = {
+      {0, static_cast<int>(levels.size()) - 1, 0, 0, 0}};
+  nodes_.push_back({kLeaf, kAir});
+  while (!stack.empty()) {
+    Pending cell = stack.back();
+    stack.pop_back();
+
+    int size = size_ >> cell.level;
+    int16_t id = levels[cell.level][(cell.x * size + cell.z) * size + cell.y];
+    if (id != kMixed) {
+      nodes_[cell.node] = {kLeaf, static_cast<VoxelId>(id)};
+      continue;
+    }
+
+    uint32_t children = static_cast<uint32_t>(nodes_.size());
+    nodes_.resize(nodes_.size() + 8, {kLeaf, kAir});
+    nodes_[cell.node].children = children;
+    for (int octant = 0; octant < 8; octant++) {
+      stack.push_back({children + octant, cell.level - 1,
+                       2 * cell.x + (octant & 1),
+                       2 * cell.y + (octant >> 1 & 1),
+                       2 * cell.z + (octant >> 2)});
+    }
+  }
+}
+
+VoxelId VoxelOctree::Get(int x, int y, int z) const {
+  uint32_t node = 0;
+  for (int half = size_ / 2; nodes_[node].children != kLeaf; half /= 2) {
+    node = nodes_[node].children + Octant(x, y, z, half);
+  }
+  return nodes_[node].id;
+}
+
+int VoxelOctree::FindLeaf(int x, int y, int z, int min[3], VoxelId* id) const {
+  min[0] = min[1] = min[2] = 0;
+  uint32_t node = 0;
+  int size = size_;
+  while (nodes_[node].children != kLeaf) {
+    size /= 2;
+    int octant = Octant(x, y, z, size);
+    min[0] += octant & 1 ? size : 0;
+    min[1] += octant & 2 ? size : 0;
+    min[2] += octant & 4 ? size : 0;
+    node = nodes_[node].children + octant;
+  }
+  *id = nodes_[node].id;
+  return size;
+}
+
+uint32_t VoxelOctree::AllocateChildren(VoxelId id) {
+  uint32_t children;
+  if (!free_.empty()) {
+    children = free_.back();
+    free_.pop_back();
+  } else {
+    children = static_cast<uint32_t>(nodes_.size());
+    nodes_.resize(nodes_.size() + 8);
+  }
+  for (int octant = 0; octant < 8; octant++) {
+    nodes_[children + octant] = {kLeaf, id};
+  }
+  return children;
+}
+
+void VoxelOctree::Set(int x, int y, int z, VoxelId id) {
+  uint32_t path[32];
+  int depth = 0;
+  uint32_t node = 0;
+  for (int half = size_ / 2;; half /= 2) {
+    if (nodes_[node].children == kLeaf) {
+      if (nodes_[node].id == id) {
+        return;
+      }
+      if (half == 0) {
+        break;
+      }
+      // Allocated before indexing nodes_ again, it may grow.
+      uint32_t children = AllocateChildren(nodes_[node].id);
+      nodes_[node].children = children;
+    }
+    path[depth++] = node;
+    node = nodes_[node].children + Octant(x, y, z, half);
+  }
+  nodes_[node].id = id;
+
+  while (depth > 0) {
+    uint32_t parent = path[--depth];
+    uint32_t children = nodes_[parent].children;
+    for (int octant = 0; octant < 8; octant++) {
+      const Node& child = nodes_[children + octant];
+      if (child.children != kLeaf || child.id != id) {
+        return;
+      }
+    }
+    nodes_[parent] = {kLeaf, id};
+    free_.push_back(children);
+  }
+}
+
+bool VoxelOctree::AnySolid(const int min[3], const int max[3]) const {
+  const int origin[3] = {0, 0, 0};
+  return AnySolid(0, origin, size_, min, max);
+}
+
+bool VoxelOctree::AnySolid(uint32_t node, const int origin[3], int size,
+                           const int min[3], const int max[3]) const {
+  for (int axis = 0; axis < 3; axis++) {
+    if (origin[axis] >= max[axis] || origin[axis] + size <= min[axis]) {
+      return false;
+    }
+  }
+  const Node& n = nodes_[node];
+  if (n.children == kLeaf) {
+    return n.id != kAir;
+  }
+  int half = size / 2;
+  for (int octant = 0; octant < 8; octant++) {
+    const int child_origin[3] = {origin[0] + (octant & 1 ? half : 0),
+                                 origin[1] + (octant & 2 ? half : 0),
+                                 origin[2] + (octant & 4 ? half : 0)};
+    if (AnySolid(n.children + octant, child_origin, half, min, max)) {
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,368 @@
+#include "WorldStreamer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+WorldStreamer::WorldStreamer(ChunkGrid& grid,
+                             const TerrainGenerator& generator,
+                             ThreadPool& pool)
+    : grid_(grid), generator_(generator), pool_(pool) {}
+
+WorldStreamer::~WorldStreamer() {
+  // Jobs point back to this object.
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock, [this] { return jobs_in_flight_ == 0; });
+}
+
+RemeshPatch WorldStreamer::Update(const Math::Vec3F& camera_position,
+                                  const Math::Vec3F& camera_front) {
+  auto start = std::chrono::steady_clock::now();
+  tick_++;
+
+  // Voxel v spans [v - 0.5, v + 0.5) in world units of voxel_scale().
+  camera_x_ = (camera_position.X / grid_.voxel_scale() + 0.5f) / kChunkSize;
+  camera_z_ = (camera_position.Z / grid_.voxel_scale() + 0.5f) / kChunkSize;
+  camera_column_ = {static_cast<int>(std::floor(camera_x_)),
+                    static_cast<int>(std::floor(camera_z_))};
+  float length = std::sqrt(camera_front.X * camera_front.X +
+                           camera_front.Z * camera_front.Z);
+  front_x_ = length > 0 ? camera_front.X / length : 0;
+  front_z_ = length > 0 ? camera_front.Z / length : 0;
+
+  RemeshPatch patch;
+  Publish(patch);
+
+  for (auto& [coord, column] : columns_) {
+    if (InView(coord)) {
+      column.last_used = tick_;
+    }
+  }
+
+  QueueGeneration();
+  QueueMeshing();
+  QueueStores();
+  Evict(patch);
+
+  patch.milliseconds = std::chrono::duration<float, std::milli>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+  return patch;
+}
+
+float WorldStreamer::Priority(ColumnCoord column) const {
+  float dx = column.x + 0.5f - camera_x_;
+  float dz = column.z + 0.5f - camera_z_;
+  float distance = std::sqrt(dx * dx + dz * dz);
+  // From 1 straight ahead to behind_weight_ straight behind.
+  float facing =
+      distance > 0 ? (dx * front_x_ + dz * front_z_) / distance : 1;
+  return distance * (1 + (behind_weight_ - 1) * (1 - facing) * 0.5f);
+}
+
+bool WorldStreamer::InView(ColumnCoord column) const {
+  int dx = column.x - camera_column_.x;
+  int dz = column.z - camera_column_.z;
+  return dx * dx + dz * dz <= view_radius_ * view_radius_;
+}
+
+bool WorldStreamer::NeighborsSettled(ColumnCoord column) const {
+  for (int dx = -1; dx <= 1; dx++) {
+    for (int dz = -1; dz <= 1; dz++) {
+      ColumnCoord neighbor = {column.x + dx, column.z + dz};
+      auto it = columns_.find(neighbor);
+      bool loaded = it != columns_.end() && it->second.loaded;
+      if (!loaded && InView(neighbor)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void WorldStreamer::MarkNeighborsForMeshing(ColumnCoord column,
+                                            bool include_cached) {
+  for (int dx = -1; dx <= 1; dx++) {
+    for (int dz = -1; dz <= 1; dz++) {
+      auto it = columns_.find({column.x + dx, column.z + dz});
+      if ((dx == 0 && dz == 0) || it == columns_.end() ||
+          !it->second.loaded ||
+          (it->second.cached_mesh && !include_cached)) {
+        continue;
+      }
+      it->second.cached_mesh = false;
+      for (int cy : it->second.chunk_ys) {
+        ChunkCoord coord = {column.x + dx, cy, column.z + dz};
+        Chunk* chunk = grid_.FindChunk(coord);
+        if (chunk != nullptr) {
+          chunk->revision_++;
+          mesh_requests_.insert(coord);
+        }
+      }
+    }
+  }
+}
+
+void WorldStreamer::Publish(RemeshPatch& patch) {
+  std::vector<GeneratedColumn> generated;
+  std::vector<MeshedChunk> meshed;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    generated.swap(generated_);
+    meshed.swap(meshed_);
+  }
+
+  for (GeneratedColumn& result : generated) {
+    Column& column = columns_[result.coord];
+    column.loaded = true;
+    column.cached_mesh = result.meshed;
+    column.stored = result.meshed;
+    bool kept_edits = false;
+    for (auto& [cy, chunk] : result.chunks) {
+      ChunkCoord coord = {result.coord.x, cy, result.coord.z};
+      Chunk& target = grid_.GetOrCreateChunk(coord);
+      column.chunk_ys.push_back(cy);
+      if (target.edited_) {
+        // Edited before its column arrived: the edits win over the generated
+        // voxels, and RebuildDirty() meshes the chunk as for any edit.
+        kept_edits = true;
+        continue;
+      }
+      uint32_t revision = target.revision_ + 1;
+      target = std::move(chunk);
+      target.revision_ = revision;
+      // Meshed by a job below rather than by RebuildDirty().
+      target.dirty_ = false;
+      if (result.meshed) {
+        patch.chunks.push_back(coord);
+      } else {
+        mesh_requests_.insert(coord);
+      }
+    }
+    if (kept_edits) {
+      // The other meshes of the column assumed the generated voxels.
+      column.cached_mesh = false;
+      for (int cy : column.chunk_ys) {
+        Chunk* chunk = grid_.FindChunk({result.coord.x, cy, result.coord.z});
+        chunk->dirty_ = true;
+        chunk->revision_++;
+      }
+    }
+    MarkNeighborsForMeshing(result.coord, false);
+  }
+
+  for (MeshedChunk& result : meshed) {
+    meshing_.erase(result.coord);
+    // Evicted or changed since the snapshot was taken: a newer request is
+    // already pending, or RebuildDirty() takes care of it.
+    Chunk* chunk = grid_.FindChunk(result.coord);
+    if (chunk == nullptr || chunk->revision_ != result.revision) {
+      continue;
+    }
+    chunk->mesh_ = std::move(result.chunk.mesh_);
+    chunk->lod_meshes_ = std::move(result.chunk.lod_meshes_);
+    patch.chunks.push_back(result.coord);
+  }
+}
+
+void WorldStreamer::QueueGeneration() {
+  std::vector<std::pair<float, ColumnCoord>> wanted;
+  for (int dx = -view_radius_; dx <= view_radius_; dx++) {
+    for (int dz = -view_radius_; dz <= view_radius_; dz++) {
+      ColumnCoord column = {camera_column_.x + dx, camera_column_.z + dz};
+      if (InView(column) && !columns_.contains(column)) {
+        wanted.emplace_back(Priority(column), column);
+      }
+    }
+  }
+  std::sort(wanted.begin(), wanted.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  for (const auto& [priority, coord] : wanted) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (jobs_in_flight_ >= max_jobs_in_flight_) {
+        return;
+      }
+      jobs_in_flight_++;
+    }
+    columns_[coord].last_used = tick_;
+
+    pool_.Submit([this, coord] {
+      GeneratedColumn result = {coord, {}};
+      if (cache_ != nullptr &&
+          cache_->LoadColumn(coord, result.chunks, &result.meshed)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        generated_.push_back(std::move(result));
+        jobs_in_flight_--;
+        idle_.notify_all();
+        return;
+      }
+
+      result.chunks.clear();
+      result.meshed = false;
+      ChunkColumn column;
+      generator_.ComputeColumn(coord.x, coord.z, column);
+      for (int cy = generator_.MinChunkY(); cy <= generator_.MaxChunkY(column);
+           cy++) {
+        Chunk& chunk = result.chunks.emplace_back(cy, Chunk()).second;
+        generator_.FillChunk(column, cy, chunk);
+      }
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      generated_.push_back(std::move(result));
+      jobs_in_flight_--;
+      idle_.notify_all();
+    });
+  }
+}
+
+void WorldStreamer::QueueMeshing() {
+  std::vector<std::pair<float, ChunkCoord>> ready;
+  for (auto it = mesh_requests_.begin(); it != mesh_requests_.end();) {
+    const Chunk* chunk = grid_.FindChunk(*it);
+    if (chunk == nullptr || chunk->dirty_) {
+      // Gone, or remeshed by RebuildDirty() this frame.
+      it = mesh_requests_.erase(it);
+      continue;
+    }
+    if (!meshing_.contains(*it) && NeighborsSettled({it->x, it->z})) {
+      ready.emplace_back(Priority({it->x, it->z}), *it);
+    }
+    ++it;
+  }
+  std::sort(ready.begin(), ready.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  for (const auto& [priority, coord] : ready) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (jobs_in_flight_ >= max_jobs_in_flight_) {
+        return;
+      }
+      jobs_in_flight_++;
+    }
+    mesh_requests_.erase(coord);
+    meshing_.insert(coord);
+
+    // The job works on copies, the grid keeps changing meanwhile.
+    const Chunk& chunk = *grid_.FindChunk(coord);
+    std::vector<VoxelId> padded;
+    grid_.GatherPadded(coord, padded);
+    pool_.Submit([this, coord, revision = chunk.revision_,
+                  voxels = chunk.voxels_, octree = chunk.octree_,
+                  padded = std::move(padded)] {
+      MeshedChunk result = {coord, revision, Chunk()};
+      result.chunk.voxels_ = voxels;
+      result.chunk.octree_ = octree;
+      grid_.MeshChunk(coord, padded, result.chunk);
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      meshed_.push_back(std::move(result));
+      jobs_in_flight_--;
+      idle_.notify_all();
+    });
+  }
+}
+
+void WorldStreamer::QueueStores() {
+  if (cache_ == nullptr) {
+    return;
+  }
+
+  for (auto& [coord, column] : columns_) {
+    if (!column.loaded || column.stored || column.edited) {
+      continue;
+    }
+
+    // Only complete meshes of unedited chunks are stored: every neighbor
+    // loaded and no remesh pending or running. Edits are not persisted, so an
+    // edited column is left to be generated again, consistent with the
+    // neighbor meshes already stored.
+    bool complete = true;
+    for (int dx = -1; dx <= 1 && complete; dx++) {
+      for (int dz = -1; dz <= 1 && complete; dz++) {
+        auto it = columns_.find({coord.x + dx, coord.z + dz});
+        complete = it != columns_.end() && it->second.loaded;
+      }
+    }
+    for (size_t i = 0; i < column.chunk_ys.size() && complete; i++) {
+      ChunkCoord chunk_coord = {coord.x, column.chunk_ys[i], coord.z};
+      const Chunk* chunk = grid_.FindChunk(chunk_coord);
+      if (chunk != nullptr && chunk->edited_) {
+        column.edited = true;
+      }
+      complete = chunk != nullptr && !chunk->dirty_ &&
+                 !mesh_requests_.contains(chunk_coord) &&
+                 !meshing_.contains(chunk_coord);
+    }
+    if (!complete || column.edited) {
+      continue;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (jobs_in_flight_ >= max_jobs_in_flight_) {
+        return;
+      }
+      jobs_in_flight_++;
+    }
+    column.stored = true;
+
+    // Written from copies, the chunks may change or go away meanwhile.
+    std::vector<std::pair<int, Chunk>> chunks;
+    for (int cy : column.chunk_ys) {
+      chunks.emplace_back(cy, *grid_.FindChunk({coord.x, cy, coord.z}));
+    }
+    pool_.Submit([this, coord, chunks = std::move(chunks)] {
+      std::vector<std::pair<int, const Chunk*>> views;
+      for (const auto& [cy, chunk] : chunks) {
+        views.emplace_back(cy, &chunk);
+      }
+      cache_->StoreColumn(coord, views, true);
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      jobs_in_flight_--;
+      idle_.notify_all();
+    });
+  }
+}
+
+void WorldStreamer::Evict(RemeshPatch& patch) {
+  memory_usage_ = 0;
+  for (const auto& [coord, chunk] : grid_.chunks()) {
+    memory_usage_ += chunk.memory_usage();
+  }
+  if (memory_usage_ <= memory_budget_) {
+    return;
+  }
+
+  // Least recently used first, never a column in view or still generating.
+  std::vector<std::pair<uint64_t, ColumnCoord>> candidates;
+  for (const auto& [coord, column] : columns_) {
+    if (column.loaded && column.last_used < tick_) {
+      candidates.emplace_back(column.last_used, coord);
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  for (const auto& [last_used, coord] : candidates) {
+    if (memory_usage_ <= memory_budget_) {
+      break;
+    }
+    for (int cy : columns_[coord].chunk_ys) {
+      ChunkCoord chunk_coord = {coord.x, cy, coord.z};
+      const Chunk* chunk = grid_.FindChunk(chunk_coord);
+      if (chunk != nullptr) {
+        memory_usage_ -= chunk->memory_usage();
+        grid_.RemoveChunk(chunk_coord);
+        patch.chunks.push_back(chunk_coord);
+      }
+      mesh_requests_.erase(chunk_coord);
+    }
+    columns_.erase(coord);
+    // Their border now sees air where the column was.
+    MarkNeighborsForMeshing(coord, true);
+  }
+}
@@ -0,0 +1,68 @@
+// Headless check that packed chunk meshes decode to the culled meshes: every
+// chunk of a fixed seed terrain is meshed both ways and must give the same
+// vertices, bit for bit, and the same indices. Exits with 1 otherwise.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "ChunkGrid.h"
+#include "PackedVertex.h"
+#include "TerrainGenerator.h"
+#include "ThreadPool.h"
+
+static std::vector<uint32_t> Indices(const GeometryBuilder& mesh) {
+  if (mesh.index_format_ == IndexFormat::kUInt32) {
+    return mesh.indices_;
+  }
+  return std::vector<uint32_t>(mesh.indices16_.begin(), mesh.indices16_.end());
+}
+
+int main() {
+  ThreadPool pool;
+  ChunkGrid grid(0.2f);
+  grid.mesh_mode_ = MeshMode::kCulled;
+  grid.palette_ = {Vec3(0, 0, 0), Vec3(0, 0.8, 0), Vec3(0, 0.5, 0)};
+
+  // The checkerboard gives neighbor voxels different palette indices.
+  TerrainGenerator terrain(1337);
+  terrain.checkerboard_ = true;
+  terrain.Generate(grid, pool);
+  grid.RebuildDirty(&pool);
+
+  size_t chunks = 0;
+  size_t vertices = 0;
+  size_t mismatches = 0;
+  for (const auto& [coord, chunk] : grid.chunks()) {
+    PackedGeometryBuilder packed;
+    grid.MeshPacked(coord, packed);
+    const int origin[3] = {coord.x * kChunkSize, coord.y * kChunkSize,
+                           coord.z * kChunkSize};
+    GeometryBuilder decoded =
+        UnpackMesh(packed, origin, grid.voxel_scale(), grid.palette_);
+
+    const GeometryBuilder& mesh = chunk.mesh_;
+    bool same =
+        decoded.vertices_.size() == mesh.vertices_.size() &&
+        memcmp(decoded.vertices_.data(), mesh.vertices_.data(),
+               mesh.vertices_.size() * sizeof(Vertex)) == 0 &&
+        Indices(decoded) == Indices(mesh);
+    if (!same) {
+      printf("chunk %d %d %d: %zu decoded vertices, %zu culled\n", coord.x,
+             coord.y, coord.z, decoded.vertices_.size(),
+             mesh.vertices_.size());
+      mismatches++;
+    }
+    chunks++;
+    vertices += mesh.vertices_.size();
+  }
+
+  printf("%zu chunks, %zu vertices, %zu packed bytes instead of %zu\n", chunks,
+         vertices, vertices * sizeof(PackedVertex), vertices * sizeof(Vertex));
+  if (mismatches > 0) {
+    printf("%zu chunks decode to other meshes\n", mismatches);
+    return 1;
+  }
+  return 0;
+}
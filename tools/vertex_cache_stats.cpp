@@ -0,0 +1,94 @@
+// Headless report of how well the chunk meshes use the post-transform vertex
+// cache, before and after Tipsify. Needs no GPU, so CI can track it: exits
+// with 1 when the optimized meshes miss the thresholds below.
+
+#include <stdio.h>
+
+#include <vector>
+
+#include "ChunkGrid.h"
+#include "TerrainGenerator.h"
+#include "ThreadPool.h"
+#include "VertexCache.h"
+
+// The best ACMR depends on how many vertices the quads share, so it is
+// checked against the raw meshes: Tipsify gets these about a third lower and
+// each vertex transformed close to once.
+constexpr float kMaxAcmrRatio = 0.8f;
+constexpr float kMaxOptimizedAtvr = 1.15f;
+
+struct CacheTotals {
+  double misses = 0;
+  double triangles = 0;
+  double referenced = 0;
+
+  void Add(const GeometryBuilder& mesh) {
+    std::vector<uint32_t> indices(mesh.indices16_.begin(),
+                                  mesh.indices16_.end());
+    if (mesh.index_format_ == IndexFormat::kUInt32) {
+      indices = mesh.indices_;
+    }
+    size_t triangle_count = indices.size() / 3;
+    if (triangle_count == 0) {
+      return;
+    }
+    VertexCacheStats stats =
+        SimulateVertexCache(indices, mesh.vertices_.size());
+    double mesh_misses = static_cast<double>(stats.acmr) * triangle_count;
+    misses += mesh_misses;
+    triangles += triangle_count;
+    referenced += mesh_misses / stats.atvr;
+  }
+
+  float acmr() const { return triangles > 0 ? misses / triangles : 0; }
+  float atvr() const { return referenced > 0 ? misses / referenced : 0; }
+};
+
+// Cache totals over every mesh of a fixed seed terrain, all LODs included.
+static CacheTotals MeshTerrain(MeshMode mode, bool optimize,
+                               ThreadPool& pool) {
+  ChunkGrid grid(0.2f);
+  grid.mesh_mode_ = mode;
+  grid.weld_vertices_ = true;
+  grid.optimize_vertex_cache_ = optimize;
+  grid.build_lods_ = true;
+  grid.palette_ = {Vec3(0, 0, 0), Vec3(0, 0.8, 0), Vec3(0, 0.5, 0)};
+
+  TerrainGenerator terrain(1337);
+  terrain.Generate(grid, pool);
+  grid.RebuildDirty(&pool);
+
+  CacheTotals totals;
+  for (const auto& [coord, chunk] : grid.chunks()) {
+    for (int lod = 0; lod < kLodCount; lod++) {
+      totals.Add(chunk.Mesh(lod));
+    }
+  }
+  return totals;
+}
+
+int main() {
+  ThreadPool pool;
+  const struct {
+    const char* name;
+    MeshMode mode;
+  } kModes[] = {{"culled", MeshMode::kCulled},
+                {"greedy", MeshMode::kGreedy},
+                {"heightfield", MeshMode::kHeightfield}};
+
+  bool ok = true;
+  printf("%-12s %9s %9s %9s %9s\n", "mode", "raw ACMR", "raw ATVR",
+         "opt ACMR", "opt ATVR");
+  for (const auto& [name, mode] : kModes) {
+    CacheTotals raw = MeshTerrain(mode, false, pool);
+    CacheTotals optimized = MeshTerrain(mode, true, pool);
+    printf("%-12s %9.3f %9.3f %9.3f %9.3f\n", name, raw.acmr(), raw.atvr(),
+           optimized.acmr(), optimized.atvr());
+    if (optimized.acmr() > raw.acmr() * kMaxAcmrRatio ||
+        optimized.atvr() > kMaxOptimizedAtvr) {
+      printf("%s: optimized meshes over the thresholds\n", name);
+      ok = false;
+    }
+  }
+  return ok ? 0 : 1;
+}